@@ -0,0 +1,232 @@
+// for posix_memalign
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// MEMORY
+//
+//
+
+// lvals, environments and short strings are handed out from slabs,
+// one free list per size class per thread, so the common case of
+// creating and dropping a value never touches the system allocator
+
+// bytes requested from the system each time a pool runs dry, slabs are
+// aligned to their size so an object can find its slab
+#define LSLAB_BYTES 16384
+
+// strings (with their terminator) up to this size live in the pools
+#define LSTR_POOLED 64
+
+enum { LPOOL_LVAL, LPOOL_LENV, LPOOL_STR16, LPOOL_STR32, LPOOL_STR64,
+       LPOOL_SLOTS, LPOOL_COUNT };
+
+typedef struct lslab {
+  struct lslab* next;
+  // where the objects start, and how big they are
+  char* first;
+  size_t size;
+  // a scratch count per object, only while the collector is running
+  int* gc;
+} lslab;
+
+typedef struct lpool {
+  // objects are threaded onto the free list through their second word,
+  // which leaves the refs of a free lval or lenv at zero, see lalloc_each
+  void* free;
+  lslab* slabs;
+} lpool;
+
+#define LPOOL_NEXT(obj) (((void**)(obj))[1])
+
+static __thread lpool pools[LPOOL_COUNT];
+static __thread lalloc_stats stats;
+
+// lvals and envs handed out since the last collection
+static __thread long since_gc = 0;
+
+// object sizes, rounded up so every object stays pointer aligned
+static size_t lpool_size(int p) {
+  size_t size = 0;
+  switch (p) {
+    case LPOOL_LVAL:  size = sizeof(lval); break;
+    case LPOOL_LENV:  size = sizeof(lenv); break;
+    case LPOOL_STR16: size = 16; break;
+    case LPOOL_STR32: size = 32; break;
+    case LPOOL_STR64: size = 64; break;
+    case LPOOL_SLOTS: size = 2 * LENV_SLOTS * sizeof(void*); break;
+  }
+  return (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+}
+
+static void lpool_refill(int p) {
+  size_t size = lpool_size(p);
+  void* mem;
+  if (posix_memalign(&mem, LSLAB_BYTES, LSLAB_BYTES) != 0) {
+    fputs("out of memory\n", stderr);
+    exit(1);
+  }
+  stats.mallocs++;
+
+  // zeroed, so every object starts out looking free
+  lslab* slab = memset(mem, 0, LSLAB_BYTES);
+  slab->next = pools[p].slabs;
+  slab->first = (char*)slab + ((sizeof(lslab) + 15) & ~15);
+  slab->size = size;
+  slab->gc = NULL;
+  pools[p].slabs = slab;
+
+  // carve the slab up and push every piece onto the free list
+  char* obj = slab->first;
+  char* end = (char*)slab + LSLAB_BYTES;
+  while (obj + size <= end) {
+    LPOOL_NEXT(obj) = pools[p].free;
+    pools[p].free = obj;
+    obj += size;
+  }
+}
+
+static void* lpool_get(int p) {
+  if (!pools[p].free) { lpool_refill(p); }
+
+  void* obj = pools[p].free;
+  pools[p].free = LPOOL_NEXT(obj);
+  stats.pooled++;
+
+  return obj;
+}
+
+static void lpool_put(int p, void* obj) {
+  LPOOL_NEXT(obj) = pools[p].free;
+  pools[p].free = obj;
+  stats.released++;
+}
+
+// picks the string pool for a given length (including the terminator)
+static int lstr_pool(size_t len) {
+  if (len <= 16) { return LPOOL_STR16; }
+  if (len <= 32) { return LPOOL_STR32; }
+  return LPOOL_STR64;
+}
+
+lval* lval_alloc(void) {
+  since_gc++;
+  return lpool_get(LPOOL_LVAL);
+}
+
+void lval_free(lval* v) {
+  v->refs = 0;
+  lpool_put(LPOOL_LVAL, v);
+}
+
+lenv* lenv_alloc(void) {
+  since_gc++;
+  return lpool_get(LPOOL_LENV);
+}
+
+void lenv_free(lenv* e) {
+  e->refs = 0;
+  lpool_put(LPOOL_LENV, e);
+}
+
+// the syms and vals of a small frame, see lenv_frame
+void* lslots_alloc(void) {
+  return lpool_get(LPOOL_SLOTS);
+}
+
+void lslots_free(void* slots) {
+  lpool_put(LPOOL_SLOTS, slots);
+}
+
+// copies a string into pooled storage, long ones go to the system
+char* lstr_dup(char* s) {
+  size_t len = strlen(s) + 1;
+  char* dup = (len <= LSTR_POOLED) ? lpool_get(lstr_pool(len)) : lmem_alloc(len);
+  memcpy(dup, s, len);
+
+  return dup;
+}
+
+void lstr_free(char* s) {
+  size_t len = strlen(s) + 1;
+  if (len <= LSTR_POOLED) {
+    lpool_put(lstr_pool(len), s);
+  } else {
+    lmem_free(s);
+  }
+}
+
+// counted wrappers around the system allocator, for variable sized
+// things such as the cells of an expression
+void* lmem_alloc(size_t size) {
+  stats.mallocs++;
+  return malloc(size);
+}
+
+void* lmem_realloc(void* p, size_t size) {
+  stats.mallocs++;
+  return realloc(p, size);
+}
+
+void lmem_free(void* p) {
+  if (!p) { return; }
+  stats.frees++;
+  free(p);
+}
+
+lalloc_stats* lalloc_stats_get(void) {
+  return &stats;
+}
+
+//
+// for the collector, see gc.c
+//
+
+long lalloc_since_gc(void) {
+  return since_gc;
+}
+
+// calls fn on every live lval (envs == 0) or lenv (envs == 1)
+void lalloc_each(int envs, void (*fn)(void*)) {
+  for (lslab* slab = pools[envs ? LPOOL_LENV : LPOOL_LVAL].slabs; slab; slab = slab->next) {
+    char* end = (char*)slab + LSLAB_BYTES;
+    for (char* obj = slab->first; obj + slab->size <= end; obj += slab->size) {
+      int refs = envs ? ((lenv*)obj)->refs : ((lval*)obj)->refs;
+      if (refs) { fn(obj); }
+    }
+  }
+}
+
+// gives every lval and lenv a scratch count, see lalloc_gc_count
+void lalloc_gc_begin(void) {
+  for (int p = LPOOL_LVAL; p <= LPOOL_LENV; p++) {
+    for (lslab* slab = pools[p].slabs; slab; slab = slab->next) {
+      size_t n = (LSLAB_BYTES - (slab->first - (char*)slab)) / slab->size;
+      slab->gc = lmem_alloc(sizeof(int) * n);
+    }
+  }
+}
+
+void lalloc_gc_end(void) {
+  for (int p = LPOOL_LVAL; p <= LPOOL_LENV; p++) {
+    for (lslab* slab = pools[p].slabs; slab; slab = slab->next) {
+      lmem_free(slab->gc);
+      slab->gc = NULL;
+    }
+  }
+  since_gc = 0;
+}
+
+// the scratch count of a pooled lval or lenv
+int* lalloc_gc_count(void* obj) {
+  lslab* slab = (lslab*)((unsigned long)obj & ~(unsigned long)(LSLAB_BYTES - 1));
+  return &slab->gc[((char*)obj - slab->first) / slab->size];
+}
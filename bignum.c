@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// BIG NUMBERS
+//
+//
+
+// integers which don't fit in a long, which arithmetic on numbers moves
+// on to when it overflows, and back from as soon as the result fits again,
+// so there is only ever one way of holding any given integer
+
+// the magnitude is held in base 2^32 limbs, least significant first, with
+// the sign apart from it, arithmetic works on the magnitudes and sorts out
+// the sign afterwards
+
+typedef unsigned int limb;
+typedef unsigned long long dlimb;
+
+#define LBIG_BASE ((dlimb)1 << 32)
+
+// below this many limbs multiplying is done the schoolbook way, above it
+// Karatsuba's three half size products win
+#define LBIG_KARATSUBA 32
+
+// the most bits '^' will make a number, past that it's surely a mistake
+#define LBIG_MAX_BITS (1L << 22)
+
+// a number being worked on, either a big number's limbs, borrowed, or
+// ones of our own
+typedef struct lbig {
+  limb* limbs;
+  int count;
+  int negative;
+  limb small[2];
+} lbig;
+
+// v, which is a number or a big number, as an lbig, which only borrows
+// a big number's limbs, so mustn't be freed
+static void lbig_of(lval* v, lbig* b) {
+  if (v->type == LVAL_BIG) {
+    b->limbs = v->limbs;
+    b->count = v->limbs_count;
+    b->negative = v->negative;
+    return;
+  }
+
+  // LONG_MIN has no positive counterpart as a long, but does unsigned
+  unsigned long m = v->num < 0 ? -(unsigned long)v->num : (unsigned long)v->num;
+  b->small[0] = (limb)m;
+  b->small[1] = (limb)(m >> 32);
+  b->limbs = b->small;
+  b->count = b->small[1] ? 2 : (b->small[0] ? 1 : 0);
+  b->negative = v->num < 0;
+}
+
+static limb* lbig_alloc(int count) {
+  limb* limbs = lmem_alloc(sizeof(limb) * (count ? count : 1));
+  memset(limbs, 0, sizeof(limb) * count);
+  return limbs;
+}
+
+// how many of the count limbs matter, with the leading zeros dropped
+static int lbig_trim(limb* limbs, int count) {
+  while (count > 0 && limbs[count - 1] == 0) { count--; }
+  return count;
+}
+
+// the value of count limbs, which it takes over, as a number if it fits
+// in one, otherwise a big number
+static lval* lbig_value(limb* limbs, int count, int negative) {
+  count = lbig_trim(limbs, count);
+
+  if (count <= 2) {
+    unsigned long m = count == 0 ? 0 : limbs[0];
+    if (count == 2) { m |= (unsigned long)limbs[1] << 32; }
+
+    if (m <= LONG_MAX || (negative && m == (unsigned long)LONG_MAX + 1)) {
+      lmem_free(limbs);
+      return lval_num(negative ? (long)-m : (long)m);
+    }
+  }
+
+  return lval_big(limbs, count, negative);
+}
+
+//
+// magnitudes
+//
+
+static int lbig_cmp(limb* x, int xn, limb* y, int yn) {
+  if (xn != yn) { return xn < yn ? -1 : 1; }
+  for (int i = xn - 1; i >= 0; i--) {
+    if (x[i] != y[i]) { return x[i] < y[i] ? -1 : 1; }
+  }
+  return 0;
+}
+
+// r += x, where r has rn limbs, at least as many as x, gives the carry
+// out of the top
+static limb lbig_add_into(limb* r, int rn, limb* x, int xn) {
+  dlimb carry = 0;
+  int i = 0;
+  for (; i < xn; i++) {
+    carry += (dlimb)r[i] + x[i];
+    r[i] = (limb)carry;
+    carry >>= 32;
+  }
+  for (; carry && i < rn; i++) {
+    carry += r[i];
+    r[i] = (limb)carry;
+    carry >>= 32;
+  }
+  return (limb)carry;
+}
+
+// r -= x, where r is at least x
+static void lbig_sub_into(limb* r, int rn, limb* x, int xn) {
+  limb borrow = 0;
+  int i = 0;
+  for (; i < xn; i++) {
+    dlimb d = (dlimb)r[i] - x[i] - borrow;
+    r[i] = (limb)d;
+    borrow = (d >> 32) ? 1 : 0;
+  }
+  for (; borrow && i < rn; i++) {
+    borrow = r[i] == 0;
+    r[i]--;
+  }
+}
+
+// x * y into out, which has room for xn + yn limbs, all of which it sets
+static void lbig_mul_into(limb* x, int xn, limb* y, int yn, limb* out) {
+  if (xn < yn) {
+    limb* t = x; x = y; y = t;
+    int tn = xn; xn = yn; yn = tn;
+  }
+  memset(out, 0, sizeof(limb) * (xn + yn));
+  if (yn == 0) { return; }
+
+  if (yn < LBIG_KARATSUBA) {
+    for (int j = 0; j < yn; j++) {
+      dlimb carry = 0;
+      for (int i = 0; i < xn; i++) {
+        carry += (dlimb)x[i] * y[j] + out[i + j];
+        out[i + j] = (limb)carry;
+        carry >>= 32;
+      }
+      out[xn + j] = (limb)carry;
+    }
+    return;
+  }
+
+  // a lot longer than y, so it's multiplied a piece of y's length at a time
+  if (xn >= 2 * yn) {
+    limb* part = lbig_alloc(2 * yn);
+    for (int at = 0; at < xn; at += yn) {
+      int n = xn - at < yn ? xn - at : yn;
+      lbig_mul_into(x + at, n, y, yn, part);
+      lbig_add_into(out + at, xn + yn - at, part, n + yn);
+    }
+    lmem_free(part);
+    return;
+  }
+
+  // x = x1 B^m + x0 and y = y1 B^m + y0, with y1 never empty as xn < 2 yn,
+  // x y = z2 B^2m + ((x0 + x1)(y0 + y1) - z2 - z0) B^m + z0
+  int m = xn / 2;
+  int x1n = xn - m, y1n = yn - m;
+  lbig_mul_into(x, m, y, m, out);
+  lbig_mul_into(x + m, x1n, y + m, y1n, out + 2 * m);
+
+  int sxn = x1n + 1, syn = (y1n > m ? y1n : m) + 1;
+  limb* sx = lbig_alloc(sxn);
+  limb* sy = lbig_alloc(syn);
+  memcpy(sx, x + m, sizeof(limb) * x1n);
+  lbig_add_into(sx, sxn, x, m);
+  memcpy(sy, y, sizeof(limb) * m);
+  lbig_add_into(sy, syn, y + m, y1n);
+  sxn = lbig_trim(sx, sxn);
+  syn = lbig_trim(sy, syn);
+
+  limb* z1 = lbig_alloc(sxn + syn);
+  lbig_mul_into(sx, sxn, sy, syn, z1);
+  int z1n = sxn + syn;
+  lbig_sub_into(z1, z1n, out, lbig_trim(out, 2 * m));
+  lbig_sub_into(z1, z1n, out + 2 * m, lbig_trim(out + 2 * m, x1n + y1n));
+  z1n = lbig_trim(z1, z1n);
+  lbig_add_into(out + m, xn + yn - m, z1, z1n);
+
+  lmem_free(sx);
+  lmem_free(sy);
+  lmem_free(z1);
+}
+
+// x /= d in place, gives the remainder
+static limb lbig_div_small(limb* x, int xn, limb d) {
+  dlimb r = 0;
+  for (int i = xn - 1; i >= 0; i--) {
+    r = (r << 32) | x[i];
+    x[i] = (limb)(r / d);
+    r %= d;
+  }
+  return (limb)r;
+}
+
+// u / v into q, which has un - vn + 1 limbs, and u % v into r, which has
+// vn, v is at least two limbs with no leading zeros, and u no shorter,
+// this is Knuth's algorithm D
+static void lbig_divmod_into(limb* u, int un, limb* v, int vn, limb* q, limb* r) {
+  // shifted so the top of v is set, which keeps the guesses close
+  int s = __builtin_clz(v[vn - 1]);
+  limb* vs = lbig_alloc(vn);
+  limb* us = lbig_alloc(un + 1);
+  for (int i = vn - 1; i > 0; i--) {
+    vs[i] = (v[i] << s) | (limb)((dlimb)v[i - 1] >> (32 - s));
+  }
+  vs[0] = v[0] << s;
+  us[un] = (limb)((dlimb)u[un - 1] >> (32 - s));
+  for (int i = un - 1; i > 0; i--) {
+    us[i] = (u[i] << s) | (limb)((dlimb)u[i - 1] >> (32 - s));
+  }
+  us[0] = u[0] << s;
+
+  for (int j = un - vn; j >= 0; j--) {
+    // guess at the next limb of q from the top two of what's left
+    dlimb top = ((dlimb)us[j + vn] << 32) | us[j + vn - 1];
+    dlimb qhat = top / vs[vn - 1];
+    dlimb rhat = top % vs[vn - 1];
+    while (qhat >= LBIG_BASE ||
+           qhat * vs[vn - 2] > ((rhat << 32) | us[j + vn - 2])) {
+      qhat--;
+      rhat += vs[vn - 1];
+      if (rhat >= LBIG_BASE) { break; }
+    }
+
+    // take qhat v off, it's at most one too many
+    long long borrow = 0, t;
+    for (int i = 0; i < vn; i++) {
+      dlimb p = qhat * vs[i];
+      t = (long long)us[i + j] - borrow - (long long)(p & 0xffffffff);
+      us[i + j] = (limb)t;
+      borrow = (long long)(p >> 32) - (t >> 32);
+    }
+    t = (long long)us[j + vn] - borrow;
+    us[j + vn] = (limb)t;
+
+    q[j] = (limb)qhat;
+    if (t < 0) {
+      q[j]--;
+      us[j + vn] += lbig_add_into(us + j, vn, vs, vn);
+    }
+  }
+
+  for (int i = 0; i < vn - 1; i++) {
+    r[i] = (us[i] >> s) | (limb)((dlimb)us[i + 1] << (32 - s));
+  }
+  r[vn - 1] = us[vn - 1] >> s;
+
+  lmem_free(vs);
+  lmem_free(us);
+}
+
+//
+// arithmetic
+//
+
+static lval* lbig_add(lbig* x, lbig* y, int negate_y) {
+  int yneg = y->negative ^ negate_y;
+  if (x->negative == yneg) {
+    int n = (x->count > y->count ? x->count : y->count) + 1;
+    limb* r = lbig_alloc(n);
+    memcpy(r, x->limbs, sizeof(limb) * x->count);
+    lbig_add_into(r, n, y->limbs, y->count);
+    return lbig_value(r, n, x->negative);
+  }
+
+  // signs differ, so it's the difference of the two, with the larger's sign
+  int negative = x->negative;
+  if (lbig_cmp(x->limbs, x->count, y->limbs, y->count) < 0) {
+    lbig* t = x; x = y; y = t;
+    negative = yneg;
+  }
+
+  limb* r = lbig_alloc(x->count);
+  memcpy(r, x->limbs, sizeof(limb) * x->count);
+  lbig_sub_into(r, x->count, y->limbs, y->count);
+  return lbig_value(r, x->count, negative);
+}
+
+static lval* lbig_mul(lbig* x, lbig* y) {
+  int n = x->count + y->count;
+  limb* r = lbig_alloc(n);
+  lbig_mul_into(x->limbs, x->count, y->limbs, y->count, r);
+  return lbig_value(r, n, x->negative != y->negative);
+}
+
+// x / y or x % y, rounding towards zero as C does, so the remainder takes
+// the sign of x
+static lval* lbig_div(lbig* x, lbig* y, int mod) {
+  if (y->count == 0) { return lval_err("Division by Zero!"); }
+
+  if (lbig_cmp(x->limbs, x->count, y->limbs, y->count) < 0) {
+    if (!mod) { return lval_num(0); }
+    limb* r = lbig_alloc(x->count);
+    memcpy(r, x->limbs, sizeof(limb) * x->count);
+    return lbig_value(r, x->count, x->negative);
+  }
+
+  limb* q = lbig_alloc(x->count);
+  limb* r;
+  int rn;
+  if (y->count == 1) {
+    memcpy(q, x->limbs, sizeof(limb) * x->count);
+    r = lbig_alloc(1);
+    r[0] = lbig_div_small(q, x->count, y->limbs[0]);
+    rn = 1;
+  } else {
+    r = lbig_alloc(y->count);
+    rn = y->count;
+    lbig_divmod_into(x->limbs, x->count, y->limbs, y->count, q, r);
+  }
+
+  if (mod) {
+    lmem_free(q);
+    return lbig_value(r, rn, x->negative);
+  }
+  lmem_free(r);
+  return lbig_value(q, x->count, x->negative != y->negative);
+}
+
+static long lbig_bits(lbig* x) {
+  if (x->count == 0) { return 0; }
+  return 32L * (x->count - 1) + (32 - __builtin_clz(x->limbs[x->count - 1]));
+}
+
+// x ^ y by squaring, with a negative y truncated towards zero as it is
+// for numbers
+static lval* lbig_pow(lbig* x, lbig* y) {
+  int one = x->count == 1 && x->limbs[0] == 1;
+
+  if (y->negative) {
+    if (x->count == 0) { return lval_err("Division by Zero!"); }
+    if (!one) { return lval_num(0); }
+  }
+  if (one) {
+    int odd = y->count > 0 && (y->limbs[0] & 1);
+    return lval_num(x->negative && odd ? -1 : 1);
+  }
+  if (y->count == 0) { return lval_num(1); }
+  if (x->count == 0) { return lval_num(0); }
+
+  if (y->count > 1 || lbig_bits(x) * (long)y->limbs[0] > LBIG_MAX_BITS) {
+    return lval_err("Number too big!");
+  }
+  limb e = y->limbs[0];
+
+  int n = (int)((lbig_bits(x) * (long)e + 31) / 32) + 1;
+  limb* result = lbig_alloc(n);
+  limb* base = lbig_alloc(n);
+  limb* t = lbig_alloc(2 * n);
+  result[0] = 1;
+  int rn = 1;
+  memcpy(base, x->limbs, sizeof(limb) * x->count);
+  int bn = x->count;
+
+  for (;;) {
+    if (e & 1) {
+      lbig_mul_into(result, rn, base, bn, t);
+      rn = lbig_trim(t, rn + bn);
+      memcpy(result, t, sizeof(limb) * rn);
+    }
+    e >>= 1;
+    if (!e) { break; }
+    lbig_mul_into(base, bn, base, bn, t);
+    bn = lbig_trim(t, 2 * bn);
+    memcpy(base, t, sizeof(limb) * bn);
+  }
+
+  lmem_free(base);
+  lmem_free(t);
+  return lbig_value(result, n, x->negative && (y->limbs[0] & 1));
+}
+
+// x op y, for numbers and big numbers, which builtin_op goes to once a
+// result has gone past what a long can hold, doesn't take over x or y
+lval* lbig_arith(int op, lval* x, lval* y) {
+  lbig a, b;
+  lbig_of(x, &a);
+  lbig_of(y, &b);
+
+  switch (op) {
+    case LB_ADD: return lbig_add(&a, &b, 0);
+    case LB_SUB: return lbig_add(&a, &b, 1);
+    case LB_MUL: return lbig_mul(&a, &b);
+    case LB_DIV: return lbig_div(&a, &b, 0);
+    case LB_MOD: return lbig_div(&a, &b, 1);
+    case LB_POW: return lbig_pow(&a, &b);
+  }
+  return lval_err("Unknown Operator!");
+}
+
+// -x, for a number or big number
+lval* lbig_neg(lval* x) {
+  lbig a;
+  lbig_of(x, &a);
+  limb* r = lbig_alloc(a.count);
+  memcpy(r, a.limbs, sizeof(limb) * a.count);
+  return lbig_value(r, a.count, !a.negative);
+}
+
+// x compared with y, for numbers and big numbers, as lnum_compare
+int lbig_compare(int op, lval* x, lval* y) {
+  lbig a, b;
+  lbig_of(x, &a);
+  lbig_of(y, &b);
+
+  // zero is never negative, so the signs alone can tell them apart
+  int c;
+  if (a.negative != b.negative) {
+    c = a.negative ? -1 : 1;
+  } else {
+    c = lbig_cmp(a.limbs, a.count, b.limbs, b.count);
+    if (a.negative) { c = -c; }
+  }
+  return lnum_compare(op, c, 0);
+}
+
+//
+// conversions
+//
+
+double lbig_dbl(lval* v) {
+  double d = 0;
+  for (int i = v->limbs_count - 1; i >= 0; i--) {
+    d = d * (double)LBIG_BASE + v->limbs[i];
+  }
+  return v->negative ? -d : d;
+}
+
+// x, which is whole, as a number or big number
+lval* lbig_of_dbl(double x) {
+  int negative = x < 0;
+  x = fabs(x);
+
+  // dividing by powers of two is exact, so nothing is lost along the way
+  int n = (int)(log2(x + 1) / 32) + 2;
+  limb* limbs = lbig_alloc(n);
+  for (int i = 0; i < n && x >= 1; i++) {
+    limbs[i] = (limb)fmod(x, (double)LBIG_BASE);
+    x = floor(x / (double)LBIG_BASE);
+  }
+  return lbig_value(limbs, n, negative);
+}
+
+// the digits s, with perhaps a - in front, as a number or big number
+lval* lbig_read(char* s) {
+  int negative = *s == '-';
+  if (negative) { s++; }
+
+  // nine digits at a time, as 10^9 fits in a limb
+  int len = strlen(s);
+  int n = len / 9 + 2;
+  limb* limbs = lbig_alloc(n);
+  int count = 0;
+  int at = 0;
+  while (at < len) {
+    int chunk = (len - at) % 9 ? (len - at) % 9 : 9;
+    limb scale = 1, part = 0;
+    for (int i = 0; i < chunk; i++) {
+      scale *= 10;
+      part = part * 10 + (s[at + i] - '0');
+    }
+    at += chunk;
+
+    dlimb carry = part;
+    for (int i = 0; i < count; i++) {
+      carry += (dlimb)limbs[i] * scale;
+      limbs[i] = (limb)carry;
+      carry >>= 32;
+    }
+    if (carry) { limbs[count++] = (limb)carry; }
+  }
+  return lbig_value(limbs, n, negative);
+}
+
+// v in decimal, which the caller frees with lmem_free
+char* lbig_str(lval* v) {
+  int n = v->limbs_count;
+  limb* x = lbig_alloc(n);
+  memcpy(x, v->limbs, sizeof(limb) * n);
+
+  // each limb is under ten digits, and there's the sign and the null
+  int len = 10 * n + 2;
+  char* out = lmem_alloc(len);
+  char* at = out + len - 1;
+  *at = '\0';
+
+  // nine digits at a time off the bottom
+  while (n > 0) {
+    limb part = lbig_div_small(x, n, 1000000000);
+    n = lbig_trim(x, n);
+    for (int i = 0; i < 9 && (n > 0 || part); i++) {
+      *--at = '0' + part % 10;
+      part /= 10;
+    }
+  }
+  if (v->negative) { *--at = '-'; }
+
+  memmove(out, at, strlen(at) + 1);
+  lmem_free(x);
+  return out;
+}
@@ -6,168 +6,333 @@
 #include "lispy.h"
 #include "lib.h"
 
+// environments with more symbols than this get a hash index, smaller
+// ones (most function calls) are just scanned
+#define LENV_SMALL 8
+
+// symbols are interned, so the pointer itself is a fine key
+static unsigned long lenv_hash(char* sym) {
+  return ((unsigned long)sym >> 3) * 2654435761u;
+}
+
+// (re)builds the index over every symbol in the env
+static void lenv_index(lenv* env, int cap) {
+  lmem_free(env->index);
+  env->index = lmem_alloc(sizeof(int) * cap);
+  env->index_cap = cap;
+
+  for (int i = 0; i < cap; i++) { env->index[i] = -1; }
+
+  for (int i = 0; i < env->count; i++) {
+    unsigned long j = lenv_hash(env->syms[i]) & (cap - 1);
+    while (env->index[j] != -1) { j = (j + 1) & (cap - 1); }
+    env->index[j] = i;
+  }
+}
+
+// position of sym in syms/vals, or -1 when it isn't bound here
+int lenv_find(lenv* env, char* sym) {
+  if (!env->index) {
+    for (int i = 0; i < env->count; i++) {
+      if (env->syms[i] == sym) { return i; }
+    }
+    return -1;
+  }
+
+  unsigned long j = lenv_hash(sym) & (env->index_cap - 1);
+  while (env->index[j] != -1) {
+    if (env->syms[env->index[j]] == sym) { return env->index[j]; }
+    j = (j + 1) & (env->index_cap - 1);
+  }
+  return -1;
+}
+
 lenv* lenv_new(void) {
-  lenv* env = malloc(sizeof(lenv));
+  lenv* env = lenv_alloc();
+  env->refs = 1;
   // just like cell
   env->count = 0;
+  env->cap = 0;
   env->syms = NULL;
   env->vals = NULL;
+  env->index = NULL;
+  env->index_cap = 0;
   env->parent = NULL;
+  env->pooled = 0;
 
   return env;
 }
 
-lenv* lenv_copy(lenv* org) {
-  lenv* dup = malloc(sizeof(lenv));
-
-  // copy values and pointer to parent
-  dup->count = org->count;
-  dup->parent = org->parent;
-
-  // allocate space for references and values
-  dup->syms = malloc(sizeof(char*) * dup->count);
-  dup->vals = malloc(sizeof(lval*) * dup->count);
-
-  for(int i = 0; i < dup->count; i++) {
-    // copy actual bytes here
-    dup->syms[i] = malloc(strlen(org->syms[i]) + 1);
-    strcpy(dup->syms[i], org->syms[i]);
-    // we can lval_copy and get a pointer to the copied value
-    dup->vals[i] = lval_copy(org->vals[i]);
+// whether sym is bound anywhere but the global environment matters to
+// anything which remembered where a global was, see lenv_version
+static void lenv_local(char* sym) {
+  int* flags = lsym_flags(sym);
+  if (!(*flags & LSYM_LOCAL)) {
+    *flags |= LSYM_LOCAL;
+    lenv_version++;
   }
+}
+
+// a frame below parent binding each of formals, which are all distinct
+// and no more than LENV_SLOTS, to vals, taking over their references,
+// everything it needs comes from the pools in one go
+lenv* lenv_frame(lenv* parent, lval* formals, lval** vals) {
+  lenv* env = lenv_new();
+  env->parent = lenv_copy(parent);
+
+  env->syms = lslots_alloc();
+  env->vals = (lval**)(env->syms + LENV_SLOTS);
+  env->cap = LENV_SLOTS;
+  env->pooled = 1;
+
+  int n = formals->count;
+  for (int i = 0; i < n; i++) {
+    env->syms[i] = formals->cell[i]->sym;
+    lenv_local(env->syms[i]);
+  }
+  memcpy(env->vals, vals, sizeof(lval*) * n);
+  env->count = n;
 
-  return dup;
+  return env;
 }
 
-void lenv_del(lenv* env) {
-  // free the references in the syms, and the lvals they refer to
-  for(int i = 0; i < env->count; i++) {
-    free(env->syms[i]);
-    lval_del(env->vals[i]);
+// frees what holds env's symbols and values, but not the values
+void lenv_free_storage(lenv* env) {
+  if (env->pooled) {
+    lslots_free(env->syms);
+  } else {
+    lmem_free(env->syms);
+    lmem_free(env->vals);
   }
+  lmem_free(env->index);
+}
 
-  // free pointers to the start of the reference array and values array
-  free(env->syms);
-  free(env->vals);
+// environments are shared, so copying one just takes another reference
+lenv* lenv_copy(lenv* org) {
+  org->refs++;
+  return org;
+}
+
+// drops a reference, freeing the environment once nobody holds it
+void lenv_del(lenv* env) {
+  if (--env->refs > 0) { return; }
 
-  // free pointer to the environment
-  free(env);
+  // taken apart along with any values, see lval_bury
+  lval_bury(NULL, env);
 }
 
 // returns a copy of the value given
 lval* lenv_get(lenv* env, lval* key) {
 
-  // since we're not using a hash of any sort iterate over the entire thing! wheeeeeeeeeeeeeeeeeeeeeeeeee...n
-  for(int i = 0; i < env->count; i++) {
-    if (strcmp(env->syms[i], key->sym) == 0) {
+  // resolved symbols go straight to their slot, as long as it's still
+  // holding that symbol, see lval_resolve, what's closed over only while
+  // nothing nearer could have bound it since
+  if (key->depth == 0 ||
+      (key->depth > 0 && !(*lsym_flags(key->sym) & LSYM_SHADOWS))) {
+    lenv* e = env;
+    for (int d = 0; e && d < key->depth; d++) { e = e->parent; }
+
+    if (e && key->slot < e->count && e->syms[key->slot] == key->sym) {
+      return lval_copy(e->vals[key->slot]);
+    }
+  }
+
+  // otherwise check each environment, then its parent, and so on...
+  for (; env->parent; env = env->parent) {
+    int i = lenv_find(env, key->sym);
+    if (i != -1) {
       // return a copy of the value
       return lval_copy(env->vals[i]);
     }
   }
 
-  // additionally now, crazy town as it is, check the parents environment, recursively
-  if(env->parent) {
-    return lenv_get(env->parent, key);
-  } else {
-    return lval_err("Unbound Symbol, there is no such function or reference '%s'", key->sym);
+  // ...up to the global one, where globals remember their slot
+  if (key->depth == LSYM_GLOBAL && key->slot >= 0 &&
+      key->slot < env->count && env->syms[key->slot] == key->sym) {
+    return lval_copy(env->vals[key->slot]);
+  }
+
+  int i = lenv_find(env, key->sym);
+  if (i != -1) {
+    if (key->depth == LSYM_GLOBAL) { key->slot = i; }
+    return lval_copy(env->vals[i]);
   }
+
+  return lval_err("Unbound Symbol, there is no such function or reference '%s'", key->sym);
 }
 
+// bumped whenever a global is defined, and the first time any name is
+// bound other than globally, so what a global lookup found can be
+// remembered until it changes, see LOP_GLOBAL in vm.c
+unsigned long lenv_version = 1;
+
 void lenv_put(lenv* env, lval* key, lval* value) {
+  if (!env->parent) {
+    lenv_version++;
+  } else {
+    lenv_local(key->sym);
+  }
 
-  // iterate over existing keys and replace
-  for(int i = 0; i < env->count; i++) {
-    if (strcmp(env->syms[i], key->sym) == 0) {
-      // free old references
-      lval_del(env->vals[i]);
-      // update value and return
-      env->vals[i] = lval_copy(value);
-      return;
-    }
+  // replace an existing key
+  int i = lenv_find(env, key->sym);
+  if (i != -1) {
+    // a global being redefined isn't a constant
+    if (!env->parent) { lsym_varies(key->sym); }
+
+    // free old references
+    lval_del(env->vals[i]);
+    // update value and return
+    env->vals[i] = lval_copy(value);
+    return;
   }
 
   // or insert
-
-  // increment count and resize to it
+  if (env->parent) { *lsym_flags(key->sym) |= LSYM_SHADOWS; }
+
+  // grow geometrically rather than once per symbol
+  if (env->count == env->cap) {
+    env->cap = env->cap ? env->cap * 2 : 4;
+
+    // a frame which has outgrown its pooled block moves out of it
+    if (env->pooled) {
+      char** syms = env->syms;
+      lval** vals = env->vals;
+      env->syms = lmem_alloc(sizeof(char*) * env->cap);
+      env->vals = lmem_alloc(sizeof(lval*) * env->cap);
+      memcpy(env->syms, syms, sizeof(char*) * env->count);
+      memcpy(env->vals, vals, sizeof(lval*) * env->count);
+      lslots_free(syms);
+      env->pooled = 0;
+    } else {
+      env->vals = lmem_realloc(env->vals, sizeof(lval*) * env->cap);
+      env->syms = lmem_realloc(env->syms, sizeof(char*) * env->cap);
+    }
+  }
   env->count++;
-  env->vals = realloc(env->vals, sizeof(lval*) * env->count);
-  env->syms = realloc(env->syms, sizeof(char*) * env->count);
 
   // copy the lispy value, store a pointer to it at the end of env's vals array
   env->vals[env->count-1] = lval_copy(value);
-  // allocate space for the reference we were given
-  env->syms[env->count-1] = malloc(strlen(key->sym) + 1);
-  // store the actual bytes
-  strcpy(env->syms[env->count-1], key->sym);
+  // the reference we were given is interned, so just point at it
+  env->syms[env->count-1] = key->sym;
+
+  // keep the index no more than half full, creating it once we're no
+  // longer small enough to scan
+  if (env->count > LENV_SMALL && 2 * env->count > env->index_cap) {
+    lenv_index(env, env->index_cap ? env->index_cap * 2 : 4 * LENV_SMALL);
+  } else if (env->index) {
+    unsigned long j = lenv_hash(key->sym) & (env->index_cap - 1);
+    while (env->index[j] != -1) { j = (j + 1) & (env->index_cap - 1); }
+    env->index[j] = env->count - 1;
+  }
 }
 
 // define a 'global' variable
 void lenv_def(lenv* env, lval* key, lval* value) {
-  if (env->parent) {
-    lenv_def(env->parent, key, value);
-  } else {
-    lenv_put(env, key, value);
-  }
+  while (env->parent) { env = env->parent; }
+  lenv_put(env, key, value);
 }
 
 // create the environment...
 
-// straight copied and added too
-// we're getting back copies of these lvals so free the ones passed in
-void lenv_add_builtin(lenv* e, char* name, lbuiltin builtin) {
-  lval* k = lval_sym(name);
-  lval* v = lval_fun(builtin);
-  lenv_put(e, k, v);
-  lval_del(k); lval_del(v);
-}
-
-void lenv_add_builtins(lenv* e) {
-  lenv_add_builtin(e, "load",  builtin_load); 
+// every builtin, what it is and what it takes, checked before it's called
+// so the builtins don't have to, see lbuiltin_call
+static lbuiltin_info builtins[] = {
+  { "load",  builtin_load,  LB_NONE, 1, 1, "s" },
 
-  lenv_add_builtin(e, "error", builtin_error);
+  { "error", builtin_error, LB_NONE, 1, 1, "s" },
 
   /* List Functions */
-  lenv_add_builtin(e, "def",  builtin_def);
-  lenv_add_builtin(e, "=",    builtin_put);
-  lenv_add_builtin(e, "min",  builtin_min);
-  lenv_add_builtin(e, "max",  builtin_max);
-
-  lenv_add_builtin(e, ">", builtin_gt);
-  lenv_add_builtin(e, "<", builtin_lt);
-  lenv_add_builtin(e, ">=", builtin_gte);
-  lenv_add_builtin(e, "<=", builtin_lte);
-  lenv_add_builtin(e, "==", builtin_eq);
-  lenv_add_builtin(e, "!=", builtin_neq);
-
-  lenv_add_builtin(e, "if", builtin_if);
-  lenv_add_builtin(e, "!", builtin_not);
-  lenv_add_builtin(e, "&&", builtin_and);
-  lenv_add_builtin(e, "||", builtin_or);
-
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "join", builtin_join);
-  lenv_add_builtin(e, "cons", builtin_cons);
-  lenv_add_builtin(e, "length", builtin_length);
-  lenv_add_builtin(e, "nth", builtin_nth);
-
-  lenv_add_builtin(e, "quote", builtin_quote);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "exists", builtin_exists);
-  lenv_add_builtin(e, "locals", builtin_locals);
-  lenv_add_builtin(e, "type", builtin_type);
-  lenv_add_builtin(e, "functions", builtin_functions);
-  lenv_add_builtin(e, "exit", builtin_exit);
-  lenv_add_builtin(e, "lambda", builtin_lambda);
+  { "def",   builtin_def,   LB_NONE, 1, -1, NULL, LB_SPECIAL },
+  { "=",     builtin_put,   LB_NONE, 1, -1, NULL, LB_SPECIAL },
+  { "min",   builtin_min,   LB_MIN,  1, -1, "v", LB_PURE },
+  { "max",   builtin_max,   LB_MAX,  1, -1, "v", LB_PURE },
+
+  { ">",  builtin_gt,  LB_GT,  2, 2, "v", LB_PURE },
+  { "<",  builtin_lt,  LB_LT,  2, 2, "v", LB_PURE },
+  { ">=", builtin_gte, LB_GTE, 2, 2, "v", LB_PURE },
+  { "<=", builtin_lte, LB_LTE, 2, 2, "v", LB_PURE },
+  { "==", builtin_eq,  LB_EQ,  2, 2, "v", LB_PURE },
+  { "!=", builtin_neq, LB_NEQ, 2, 2, "v", LB_PURE },
+
+  /* Special Forms, see LB_SPECIAL */
+  { "if",  builtin_if,  LB_IF,   2, 3, NULL, LB_SPECIAL },
+  { "&&",  builtin_and, LB_AND,  2, 2, NULL, LB_SPECIAL },
+  { "||",  builtin_or,  LB_OR,   2, 2, NULL, LB_SPECIAL },
+  { "do",  builtin_do,  LB_DO,   1, -1, NULL, LB_SPECIAL },
+  { "let", builtin_let, LB_NONE, 2, 2, NULL, LB_SPECIAL },
+  { "!",   builtin_not, LB_NONE, 1, 1, "*", LB_PURE },
+
+  { "head",   builtin_head,   LB_HEAD, 1, 1, "l", LB_PURE },
+  { "tail",   builtin_tail,   LB_TAIL, 1, 1, "l", LB_PURE },
+  { "join",   builtin_join,   LB_NONE, 1, -1, "q", LB_PURE },
+  { "cons",   builtin_cons,   LB_NONE, 1, -1, "q*", LB_PURE },
+  { "length", builtin_length, LB_NONE, 1, 1, "l", LB_PURE },
+  { "nth",    builtin_nth,    LB_NONE, 2, 2, "nl", LB_PURE },
+  { "slice",  builtin_slice,  LB_NONE, 3, 3, "nnq", LB_PURE },
+  { "take",   builtin_take,   LB_NONE, 2, 2, "nl", LB_PURE },
+
+  /* Lazy Values */
+  { "delay",     builtin_delay,     LB_NONE, 1, 1, "q" },
+  { "force",     builtin_force,     LB_NONE, 1, 1, "*" },
+  { "lazy-cons", builtin_lazy_cons, LB_NONE, 2, 2, "*q" },
+
+  { "quote",     builtin_quote,     LB_NONE, 0, -1, NULL },
+  { "eval",      builtin_eval,      LB_NONE, 1, 1, "q" },
+  { "exists",    builtin_exists,    LB_NONE, 1, 1, "q" },
+  { "locals",    builtin_locals,    LB_NONE, 0, -1, NULL },
+  { "type",      builtin_type,      LB_NONE, 1, 1, "*", LB_PURE },
+  { "functions", builtin_functions, LB_NONE, 0, -1, NULL },
+  { "exit",      builtin_exit,      LB_NONE, 0, -1, NULL },
+  { "lambda",    builtin_lambda,    LB_NONE, 2, 2, NULL, LB_SPECIAL },
+  { "memo",      builtin_memo,      LB_NONE, 1, 2, "*n" },
 
   /* Mathematical Functions */
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
-  lenv_add_builtin(e, "\%", builtin_mod);
-  lenv_add_builtin(e, "^", builtin_exp);
+  { "+", builtin_add, LB_ADD, 1, -1, "v", LB_PURE },
+  { "-", builtin_sub, LB_SUB, 1, -1, "v", LB_PURE },
+  { "*", builtin_mul, LB_MUL, 1, -1, "v", LB_PURE },
+  { "/", builtin_div, LB_DIV, 1, -1, "v", LB_PURE },
+  { "%", builtin_mod, LB_MOD, 1, -1, "v", LB_PURE },
+  { "^", builtin_exp, LB_POW, 1, -1, "v", LB_PURE },
+
+  { "sqrt",  builtin_sqrt,  LB_NONE, 1, 1, "r", LB_PURE },
+  { "log",   builtin_log,   LB_NONE, 1, 1, "r", LB_PURE },
+  { "exp",   builtin_exp_e, LB_NONE, 1, 1, "r", LB_PURE },
+  { "floor", builtin_floor, LB_NONE, 1, 1, "r", LB_PURE },
+
+  /* Vectors */
+  { "vec",       builtin_vec,       LB_NONE, 1, 1, "q", LB_PURE },
+  { "vec-range", builtin_vec_range, LB_NONE, 1, 1, "n", LB_PURE },
+  { "vec-list",  builtin_vec_list,  LB_NONE, 1, 1, "*", LB_PURE },
+
+  /* Maps, which change, so none of these are pure */
+  { "map-of",   builtin_map_of,   LB_NONE, 1, 1, "q" },
+  { "map-get",  builtin_map_get,  LB_NONE, 2, 3, "m**" },
+  { "map-put",  builtin_map_put,  LB_NONE, 3, 3, "m**" },
+  { "map-del",  builtin_map_del,  LB_NONE, 2, 2, "m*" },
+  { "map-keys", builtin_map_keys, LB_NONE, 1, 1, "m" },
+  { "map-size", builtin_map_size, LB_NONE, 1, 1, "m" },
+
+  { "print",        builtin_print,        LB_NONE, 0, -1, NULL },
+  { "memstats",     builtin_memstats,     LB_NONE, 0, -1, NULL },
+  { "gc",           builtin_gc,           LB_NONE, 0, -1, NULL },
+  { "gc-threshold", builtin_gc_threshold, LB_NONE, 1, 1, "n" },
+  { "eval-mode",    builtin_eval_mode,    LB_NONE, 1, 1, "s" },
+  { "jit-mode",     builtin_jit_mode,     LB_NONE, 1, 1, "s" },
+  { "simd-mode",    builtin_simd_mode,    LB_NONE, 1, 1, "s" },
+  { "max-depth",    builtin_max_depth,    LB_NONE, 1, 1, "n" },
+};
 
-  lenv_add_builtin(e, "print", builtin_print);
+// we're getting back copies of these lvals so free the ones passed in
+void lenv_add_builtin(lenv* e, lbuiltin_info* info) {
+  lval* k = lval_sym(info->name);
+  lval* v = lval_fun(info);
+  lenv_put(e, k, v);
+  lval_del(k); lval_del(v);
+}
 
+void lenv_add_builtins(lenv* e) {
+  int n = sizeof(builtins) / sizeof(builtins[0]);
+  for (int i = 0; i < n; i++) {
+    lenv_add_builtin(e, &builtins[i]);
+  }
 }
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// GARBAGE COLLECTION
+//
+//
+
+// values and environments are reference counted, which frees almost
+// everything the moment it's dropped, but not cycles, such as a frame
+// holding a closure over itself, or a function defined into the global
+// environment it closes over
+
+// so every so often we trace the heap, mark-sweep style:
+//  - every lval and lenv gets a count of the references held on it from
+//    outside the heap, its refs less the references from other objects
+//  - anything with outside references is a root, that's the global
+//    environment held by main, the frames and values on the eval stack,
+//    and so on, everything reachable from a root is marked
+//  - whatever is left is only referenced by other garbage, so is freed
+// which needs no list of roots to be kept up to date as we go
+
+// count left on everything reachable once marking is done
+#define LGC_REACHABLE -1
+
+static lgc_stats stats = { 0, 0, 0, LGC_THRESHOLD };
+
+// the work list for marking, so deep structures don't recurse
+static void** stack = NULL;
+static int stack_count = 0;
+static int stack_cap = 0;
+
+static void lgc_push(void* obj) {
+  if (stack_count == stack_cap) {
+    stack_cap = stack_cap ? stack_cap * 2 : 256;
+    stack = lmem_realloc(stack, sizeof(void*) * stack_cap);
+  }
+  stack[stack_count++] = obj;
+}
+
+// the immortal values aren't on the heap, so are never looked at
+#define LGC_VISIT(fn, v) if ((v)->refs != LVAL_IMMORTAL) { fn(v); }
+
+// calls vals or envs on each lval or lenv directly referenced by v
+static void lgc_val_children(lval* v, void (*vals)(lval*), void (*envs)(lenv*)) {
+  switch (v->type) {
+    case LVAL_FUN:
+      if (!v->builtin) {
+        envs(v->env);
+        LGC_VISIT(vals, v->formals);
+        LGC_VISIT(vals, v->body);
+      }
+      break;
+    case LVAL_PARTIAL:
+      LGC_VISIT(vals, v->applied);
+      LGC_VISIT(vals, v->bound);
+      break;
+    case LVAL_MEMO:
+      lmemo_each(v->memo, vals);
+      break;
+    case LVAL_MAP:
+      lmap_each(v->map, vals);
+      break;
+    case LVAL_VEC:
+      if (v->vec_backing) { LGC_VISIT(vals, v->vec_backing); }
+      break;
+    case LVAL_LAZY:
+      LGC_VISIT(vals, v->promised);
+      if (v->scope) { envs(v->scope); }
+      break;
+    case LVAL_SEQ:
+      LGC_VISIT(vals, v->first);
+      LGC_VISIT(vals, v->rest);
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (v->backing) {
+        LGC_VISIT(vals, v->backing);
+        break;
+      }
+      for (int i = 0; i < v->count; i++) {
+        LGC_VISIT(vals, v->cell[i]);
+      }
+      break;
+  }
+}
+
+static void lgc_env_children(lenv* e, void (*vals)(lval*), void (*envs)(lenv*)) {
+  if (e->parent) { envs(e->parent); }
+  for (int i = 0; i < e->count; i++) {
+    LGC_VISIT(vals, e->vals[i]);
+  }
+}
+
+//
+// counting references from the heap
+//
+
+static void lgc_uncount(void* obj) { (*lalloc_gc_count(obj))--; }
+static void lgc_uncount_val(lval* v) { lgc_uncount(v); }
+static void lgc_uncount_env(lenv* e) { lgc_uncount(e); }
+
+static void lgc_count_val(void* obj) {
+  *lalloc_gc_count(obj) = ((lval*)obj)->refs;
+}
+static void lgc_count_env(void* obj) {
+  *lalloc_gc_count(obj) = ((lenv*)obj)->refs;
+}
+
+static void lgc_subtract_val(void* obj) {
+  lgc_val_children(obj, lgc_uncount_val, lgc_uncount_env);
+}
+static void lgc_subtract_env(void* obj) {
+  lgc_env_children(obj, lgc_uncount_val, lgc_uncount_env);
+}
+
+//
+// marking, lvals and lenvs go on the same work list, tagged in the low bit
+//
+
+static void lgc_mark_val(lval* v) {
+  int* count = lalloc_gc_count(v);
+  if (*count == LGC_REACHABLE) { return; }
+  *count = LGC_REACHABLE;
+  lgc_push(v);
+}
+
+static void lgc_mark_env(lenv* e) {
+  int* count = lalloc_gc_count(e);
+  if (*count == LGC_REACHABLE) { return; }
+  *count = LGC_REACHABLE;
+  lgc_push((char*)e + 1);
+}
+
+static void lgc_mark_from_roots(void* obj, int env) {
+  if (*lalloc_gc_count(obj) <= 0) { return; }
+
+  if (env) { lgc_mark_env(obj); } else { lgc_mark_val(obj); }
+
+  while (stack_count) {
+    char* next = stack[--stack_count];
+    if ((unsigned long)next & 1) {
+      lgc_env_children((lenv*)(next - 1), lgc_mark_val, lgc_mark_env);
+    } else {
+      lgc_val_children((lval*)next, lgc_mark_val, lgc_mark_env);
+    }
+  }
+}
+
+static void lgc_root_val(void* obj) { lgc_mark_from_roots(obj, 0); }
+static void lgc_root_env(void* obj) { lgc_mark_from_roots(obj, 1); }
+
+//
+// sweeping
+//
+
+// garbage still holds references on live objects, which have to go
+static void lgc_release_val(lval* v) {
+  if (*lalloc_gc_count(v) == LGC_REACHABLE) { v->refs--; }
+}
+static void lgc_release_env(lenv* e) {
+  if (*lalloc_gc_count(e) == LGC_REACHABLE) { e->refs--; }
+}
+
+static void lgc_release_from_val(void* obj) {
+  if (*lalloc_gc_count(obj) == LGC_REACHABLE) { return; }
+  lgc_val_children(obj, lgc_release_val, lgc_release_env);
+}
+static void lgc_release_from_env(void* obj) {
+  if (*lalloc_gc_count(obj) == LGC_REACHABLE) { return; }
+  lgc_env_children(obj, lgc_release_val, lgc_release_env);
+}
+
+// frees the garbage itself, without following anything it points to,
+// which is either live or garbage being freed here too
+static void lgc_free_val(void* obj) {
+  if (*lalloc_gc_count(obj) == LGC_REACHABLE) { return; }
+
+  lval* v = obj;
+  switch (v->type) {
+    case LVAL_ERR: lstr_free(v->err); break;
+    case LVAL_STR: lstr_free(v->str); break;
+    case LVAL_BIG: lmem_free(v->limbs); break;
+    case LVAL_VEC:
+      if (!v->vec_backing) { lmem_free(v->vec_ints); }
+      break;
+    case LVAL_MEMO: lmemo_free(v->memo); break;
+    case LVAL_MAP: lmap_free(v->map); break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (v->code) { lvm_release(v->code); }
+      if (!v->backing && v->cell) { lmem_free(v->cell - v->off); }
+      break;
+  }
+
+  lval_free(v);
+  stats.freed++;
+}
+
+static void lgc_free_env(void* obj) {
+  if (*lalloc_gc_count(obj) == LGC_REACHABLE) { return; }
+
+  lenv* e = obj;
+  lenv_free_storage(e);
+
+  lenv_free(e);
+  stats.freed++;
+}
+
+static void lgc_count_live(void* obj) {
+  stats.live++;
+}
+
+void lgc_collect(void) {
+  lalloc_gc_begin();
+
+  lalloc_each(0, lgc_count_val);
+  lalloc_each(1, lgc_count_env);
+
+  lalloc_each(0, lgc_subtract_val);
+  lalloc_each(1, lgc_subtract_env);
+
+  lalloc_each(0, lgc_root_val);
+  lalloc_each(1, lgc_root_env);
+
+  lalloc_each(0, lgc_release_from_val);
+  lalloc_each(1, lgc_release_from_env);
+
+  lalloc_each(0, lgc_free_val);
+  lalloc_each(1, lgc_free_env);
+
+  lalloc_gc_end();
+
+  stats.live = 0;
+  lalloc_each(0, lgc_count_live);
+  lalloc_each(1, lgc_count_live);
+  stats.collections++;
+}
+
+// called between evaluation steps, when every reference is accounted for
+void lgc_maybe_collect(void) {
+  if (stats.threshold <= 0) { return; }
+
+  // don't trace a big heap over and over, wait until it has grown again
+  long due = stats.threshold > stats.live ? stats.threshold : stats.live;
+  if (lalloc_since_gc() > due) { lgc_collect(); }
+}
+
+lgc_stats* lgc_stats_get(void) {
+  return &stats;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// SYMBOL INTERNING
+//
+//
+
+// every symbol name is stored exactly once, in this table, so symbols
+// can be compared by pointer rather than strcmp, and never need freeing
+
+// each name is stored just after a word of flags about it, see lsym_flags
+#define LSYM_HEADER sizeof(long)
+
+// open addressing, linear probing, kept at most 3/4 full
+static char** table = NULL;
+static int table_cap = 0;
+static int table_count = 0;
+
+// names we look for from C, see lsym_init
+char* lsym_rest;
+char* lsym_def;
+char* lsym_put;
+char* lsym_add;
+char* lsym_sub;
+char* lsym_mul;
+char* lsym_div;
+char* lsym_mod;
+char* lsym_pow;
+char* lsym_gt;
+char* lsym_lt;
+char* lsym_gte;
+char* lsym_lte;
+char* lsym_eq;
+char* lsym_neq;
+char* lsym_if;
+char* lsym_and;
+char* lsym_or;
+char* lsym_do;
+char* lsym_head;
+char* lsym_tail;
+
+// fnv-1a
+static unsigned long lsym_hash(char* s) {
+  unsigned long h = 2166136261u;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void lsym_grow(void) {
+  char** old = table;
+  int old_cap = table_cap;
+
+  table_cap = table_cap ? table_cap * 2 : 256;
+  table = lmem_alloc(sizeof(char*) * table_cap);
+  memset(table, 0, sizeof(char*) * table_cap);
+
+  // everything has to be rehashed into the bigger table
+  for (int i = 0; i < old_cap; i++) {
+    if (!old[i]) { continue; }
+
+    unsigned long j = lsym_hash(old[i]) & (table_cap - 1);
+    while (table[j]) { j = (j + 1) & (table_cap - 1); }
+    table[j] = old[i];
+  }
+
+  lmem_free(old);
+}
+
+// returns the one and only copy of name
+char* lsym_intern(char* name) {
+  if (4 * (table_count + 1) > 3 * table_cap) { lsym_grow(); }
+
+  unsigned long i = lsym_hash(name) & (table_cap - 1);
+  while (table[i]) {
+    if (strcmp(table[i], name) == 0) { return table[i]; }
+    i = (i + 1) & (table_cap - 1);
+  }
+
+  // first time we've seen it, keep a copy for good
+  char* header = lmem_alloc(LSYM_HEADER + strlen(name) + 1);
+  memset(header, 0, LSYM_HEADER);
+  table[i] = header + LSYM_HEADER;
+  strcpy(table[i], name);
+  table_count++;
+
+  return table[i];
+}
+
+int* lsym_flags(char* sym) {
+  return (int*)(sym - LSYM_HEADER);
+}
+
+// sym has been given a new value, or bound somewhere other than the
+// global environment, so any code counting on its value has to go
+void lsym_varies(char* sym) {
+  int* flags = lsym_flags(sym);
+  if (*flags & LSYM_FOLDED) { lvm_deopt(); }
+  *flags = (*flags & ~LSYM_FOLDED) | LSYM_VARIES;
+}
+
+void lsym_init(void) {
+  lsym_rest = lsym_intern("&");
+  lsym_def  = lsym_intern("def");
+  lsym_put  = lsym_intern("=");
+  lsym_add  = lsym_intern("+");
+  lsym_sub  = lsym_intern("-");
+  lsym_mul  = lsym_intern("*");
+  lsym_div  = lsym_intern("/");
+  lsym_mod  = lsym_intern("%");
+  lsym_pow  = lsym_intern("^");
+  lsym_gt   = lsym_intern(">");
+  lsym_lt   = lsym_intern("<");
+  lsym_gte  = lsym_intern(">=");
+  lsym_lte  = lsym_intern("<=");
+  lsym_eq   = lsym_intern("==");
+  lsym_neq  = lsym_intern("!=");
+  lsym_if   = lsym_intern("if");
+  lsym_and  = lsym_intern("&&");
+  lsym_or   = lsym_intern("||");
+  lsym_do   = lsym_intern("do");
+  lsym_head = lsym_intern("head");
+  lsym_tail = lsym_intern("tail");
+}
@@ -0,0 +1,548 @@
+// mmap's MAP_ANONYMOUS isn't part of c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define LJIT_SUPPORTED 1
+#endif
+
+//
+//
+// JIT
+//
+//
+
+// once a user function has been called often enough the vm hands it to
+// ljit_compile, which turns bodies made of nothing but integer arithmetic,
+// comparisons, 'if' and calls to itself into x86-64, each piece of the
+// body pasted in from a fixed template
+
+// compiled code only ever sees numbers, so it can't go wrong in any way
+// the vm would notice, and when it might, dividing by zero, overflowing
+// into a big number or going too deep, it bails out and the vm runs the
+// call again from the start, which is fine as nothing it can do has any
+// effect but its result, when it went too deep the vm is told, so it
+// doesn't go native again for every call nested under that one, see
+// lvm_jit
+
+// everything it counted on, the builtins, constants, and the function
+// itself being bound to the globals it called them by, is checked again
+// whenever a global has been defined since, see ljit_valid
+
+int ljit_enabled = 1;
+
+// what a global has to still be for the code to hold
+enum { LGUARD_BUILTIN, LGUARD_SELF, LGUARD_NUM };
+
+typedef struct lguard {
+  char* sym;
+  int kind;
+  lbuiltin_info* info;
+  lval* body;
+  long num;
+} lguard;
+
+// the arguments are addressed with an 8 bit displacement
+#define LJIT_MAX_ARGS 8
+
+struct ljit {
+  void* mem;
+  size_t size;
+  long (*entry)(long* args, long* ctx);
+  int arity;
+  // the names of the arguments, in order, which the code finds them by,
+  // so another function with the same body only fits if they match
+  char* formals[LJIT_MAX_ARGS];
+
+  lenv* root;
+  unsigned long version;
+  lguard* guards;
+  int guards_count;
+  int guards_cap;
+};
+
+// what the code needs to get back out, see ljit_call
+enum { LJIT_CTX_RSP, LJIT_CTX_BAILED, LJIT_CTX_DEPTH, LJIT_CTX_SIZE };
+
+static lguard* ljit_guard(ljit* j, char* sym, int kind) {
+  if (j->guards_count == j->guards_cap) {
+    j->guards_cap = j->guards_cap ? j->guards_cap * 2 : 8;
+    j->guards = lmem_realloc(j->guards, sizeof(lguard) * j->guards_cap);
+  }
+  lguard* g = &j->guards[j->guards_count++];
+  memset(g, 0, sizeof(lguard));
+  g->sym = sym;
+  g->kind = kind;
+  return g;
+}
+
+// whether the code is right for the user function fn, which has its body,
+// but could take its arguments in another order, or by other names
+int ljit_fits(ljit* j, lval* fn) {
+  if (fn->formals->count != j->arity) { return 0; }
+  for (int i = 0; i < j->arity; i++) {
+    if (fn->formals->cell[i]->sym != j->formals[i]) { return 0; }
+  }
+  return 1;
+}
+
+static int lguard_holds(ljit* j, lguard* g) {
+  // bound somewhere else since, so a frame could be in the way
+  if (*lsym_flags(g->sym) & LSYM_LOCAL) { return 0; }
+
+  int i = lenv_find(j->root, g->sym);
+  if (i == -1) { return 0; }
+  lval* v = j->root->vals[i];
+
+  switch (g->kind) {
+    case LGUARD_BUILTIN:
+      return v->type == LVAL_FUN && v->builtin && v->info == g->info;
+    case LGUARD_SELF:
+      return v->type == LVAL_FUN && !v->builtin && v->body == g->body && ljit_fits(j, v);
+    case LGUARD_NUM:
+      return v->type == LVAL_NUM && v->num == g->num;
+  }
+  return 0;
+}
+
+// whether everything the code counted on still holds
+int ljit_valid(ljit* j) {
+  if (j->version == lenv_version) { return 1; }
+
+  for (int i = 0; i < j->guards_count; i++) {
+    if (!lguard_holds(j, &j->guards[i])) { return 0; }
+  }
+  j->version = lenv_version;
+  return 1;
+}
+
+void ljit_free(ljit* j) {
+#ifdef LJIT_SUPPORTED
+  if (j->mem) { munmap(j->mem, j->size); }
+#endif
+  lmem_free(j->guards);
+  lmem_free(j);
+}
+
+#ifdef LJIT_SUPPORTED
+
+//
+// emitting
+//
+
+// compiling recurses for every list inside another, past this many
+// levels the function is left to the vm
+#define LJIT_MAX_NESTING 64
+
+static unsigned char* out = NULL;
+static int out_count = 0;
+static int out_cap = 0;
+
+// what's being compiled
+static ljit* building;
+static lval* self;
+static int bail_at;
+static int body_at;
+static int loop_at;
+
+static void ljit_byte(int b) {
+  if (out_count == out_cap) {
+    out_cap = out_cap ? out_cap * 2 : 256;
+    out = lmem_realloc(out, out_cap);
+  }
+  out[out_count++] = b;
+}
+
+static void ljit_bytes(char* bytes, int n) {
+  for (int i = 0; i < n; i++) { ljit_byte((unsigned char)bytes[i]); }
+}
+
+static void ljit_int32(int x) {
+  for (int i = 0; i < 4; i++) { ljit_byte((x >> (8 * i)) & 0xff); }
+}
+
+static void ljit_int64(long x) {
+  for (int i = 0; i < 8; i++) { ljit_byte((x >> (8 * i)) & 0xff); }
+}
+
+// rel32 operands are counted from the end of the instruction
+static void ljit_patch(int at, int target) {
+  int rel = target - (at + 4);
+  for (int i = 0; i < 4; i++) { out[at + i] = (rel >> (8 * i)) & 0xff; }
+}
+
+// a jump or call, by opcode, to target, or to be patched later when
+// target is -1, returns where its operand is
+static int ljit_jump(char* op, int n, int target) {
+  ljit_bytes(op, n);
+  int at = out_count;
+  ljit_int32(0);
+  if (target != -1) { ljit_patch(at, target); }
+  return at;
+}
+
+#define LJIT_JMP     "\xe9", 1
+#define LJIT_CALL    "\xe8", 1
+#define LJIT_JE      "\x0f\x84", 2
+#define LJIT_JNE     "\x0f\x85", 2
+#define LJIT_JL      "\x0f\x8c", 2
+#define LJIT_JGE     "\x0f\x8d", 2
+#define LJIT_JLE     "\x0f\x8e", 2
+#define LJIT_JG      "\x0f\x8f", 2
+#define LJIT_JO      "\x0f\x80", 2
+
+// [rbp + disp8] holds argument i, the caller pushed them in order
+static int ljit_arg_disp(int i) {
+  return 16 + 8 * (building->arity - 1 - i);
+}
+
+//
+// compiling, each expression leaves its value in rax
+//
+
+static int ljit_list(lval* list, int tail, int depth);
+
+// the global sym, as long as nothing but the global environment has ever
+// bound it, or NULL
+static lval* ljit_global(lval* sym) {
+  if (*lsym_flags(sym->sym) & LSYM_LOCAL) { return NULL; }
+  int i = lenv_find(building->root, sym->sym);
+  return i == -1 ? NULL : building->root->vals[i];
+}
+
+static int ljit_expr(lval* v, int tail, int depth) {
+  switch (v->type) {
+    case LVAL_NUM:
+      // mov rax, imm64
+      ljit_bytes("\x48\xb8", 2);
+      ljit_int64(v->num);
+      return 1;
+
+    case LVAL_SYM: {
+      for (int i = 0; i < building->arity; i++) {
+        if (self->formals->cell[i]->sym == v->sym) {
+          // mov rax, [rbp + disp8]
+          ljit_bytes("\x48\x8b\x45", 3);
+          ljit_byte(ljit_arg_disp(i));
+          return 1;
+        }
+      }
+
+      lval* g = ljit_global(v);
+      if (!g || g->type != LVAL_NUM) { return 0; }
+      ljit_guard(building, v->sym, LGUARD_NUM)->num = g->num;
+      ljit_bytes("\x48\xb8", 2);
+      ljit_int64(g->num);
+      return 1;
+    }
+
+    case LVAL_SEXPR:
+      return ljit_list(v, tail, depth + 1);
+  }
+  return 0;
+}
+
+// the left operand in rax, the right in rcx
+static int ljit_operands(lval* a, lval* b, int depth) {
+  if (!ljit_expr(a, 0, depth)) { return 0; }
+  ljit_byte(0x50);                      // push rax
+  if (!ljit_expr(b, 0, depth)) { return 0; }
+  ljit_bytes("\x48\x89\xc1", 3);        // mov rcx, rax
+  ljit_byte(0x58);                      // pop rax
+  return 1;
+}
+
+static int ljit_arith(int op, lval* list, int depth) {
+  if (!ljit_expr(list->cell[1], 0, depth)) { return 0; }
+
+  if (op == LB_SUB && list->count == 2) {
+    ljit_bytes("\x48\xf7\xd8", 3);      // neg rax
+    ljit_jump(LJIT_JO, bail_at);
+    return 1;
+  }
+
+  for (int i = 2; i < list->count; i++) {
+    ljit_byte(0x50);                    // push rax
+    if (!ljit_expr(list->cell[i], 0, depth)) { return 0; }
+    ljit_bytes("\x48\x89\xc1", 3);      // mov rcx, rax
+    ljit_byte(0x58);                    // pop rax
+
+    switch (op) {
+      // past what a long holds is a big number, which is the vm's to make
+      case LB_ADD:
+        ljit_bytes("\x48\x01\xc8", 3);                        // add rax, rcx
+        ljit_jump(LJIT_JO, bail_at);
+        break;
+      case LB_SUB:
+        ljit_bytes("\x48\x29\xc8", 3);                        // sub rax, rcx
+        ljit_jump(LJIT_JO, bail_at);
+        break;
+      case LB_MUL:
+        ljit_bytes("\x48\x0f\xaf\xc1", 4);                    // imul rax, rcx
+        ljit_jump(LJIT_JO, bail_at);
+        break;
+      case LB_DIV:
+      case LB_MOD:
+        // dividing by zero is for the vm to report, and LONG_MIN / -1
+        // traps, so it's left to the vm as well
+        ljit_bytes("\x48\x85\xc9", 3);                        // test rcx, rcx
+        ljit_jump(LJIT_JE, bail_at);
+        ljit_bytes("\x48\x83\xf9\xff", 4);                    // cmp rcx, -1
+        ljit_jump(LJIT_JE, bail_at);
+        ljit_bytes("\x48\x99", 2);                            // cqo
+        ljit_bytes("\x48\xf7\xf9", 3);                        // idiv rcx
+        if (op == LB_MOD) { ljit_bytes("\x48\x89\xd0", 3); }  // mov rax, rdx
+        break;
+    }
+  }
+  return 1;
+}
+
+// a comparison, jumping when it's false, returns where to patch in the
+// target, or -1 when it can't be compiled
+static int ljit_cond(lval* cond, int depth) {
+  if (cond->type != LVAL_SEXPR || cond->count != 3) { return -1; }
+  if (cond->cell[0]->type != LVAL_SYM) { return -1; }
+
+  lval* fn = ljit_global(cond->cell[0]);
+  if (!fn || fn->type != LVAL_FUN || !fn->builtin) { return -1; }
+  int op = fn->info->op;
+  if (op < LB_GT || op > LB_NEQ) { return -1; }
+  ljit_guard(building, cond->cell[0]->sym, LGUARD_BUILTIN)->info = fn->info;
+
+  if (!ljit_operands(cond->cell[1], cond->cell[2], depth + 1)) { return -1; }
+  ljit_bytes("\x48\x39\xc8", 3);        // cmp rax, rcx
+
+  switch (op) {
+    case LB_GT:  return ljit_jump(LJIT_JLE, -1);
+    case LB_LT:  return ljit_jump(LJIT_JGE, -1);
+    case LB_GTE: return ljit_jump(LJIT_JL, -1);
+    case LB_LTE: return ljit_jump(LJIT_JG, -1);
+    case LB_EQ:  return ljit_jump(LJIT_JNE, -1);
+    case LB_NEQ: return ljit_jump(LJIT_JE, -1);
+  }
+  return -1;
+}
+
+// 'if' with both branches quoted in place, otherwise its value could be
+// something other than a number
+static int ljit_if(lval* list, int tail, int depth) {
+  if (list->count != 4 ||
+      list->cell[2]->type != LVAL_QEXPR || list->cell[3]->type != LVAL_QEXPR) {
+    return 0;
+  }
+
+  int on_false = ljit_cond(list->cell[1], depth);
+  if (on_false == -1) { return 0; }
+
+  if (!ljit_list(list->cell[2], tail, depth + 1)) { return 0; }
+  int end = ljit_jump(LJIT_JMP, -1);
+
+  ljit_patch(on_false, out_count);
+  if (!ljit_list(list->cell[3], tail, depth + 1)) { return 0; }
+  ljit_patch(end, out_count);
+  return 1;
+}
+
+static int ljit_self_call(lval* list, int tail, int depth) {
+  int n = building->arity;
+  if (list->count - 1 != n) { return 0; }
+
+  for (int i = 1; i < list->count; i++) {
+    if (!ljit_expr(list->cell[i], 0, depth)) { return 0; }
+    ljit_byte(0x50);                    // push rax
+  }
+
+  if (!tail) {
+    ljit_jump(LJIT_CALL, body_at);
+    return 1;
+  }
+
+  // nothing left to do here, so the arguments take the place of ours
+  for (int i = n - 1; i >= 0; i--) {
+    ljit_byte(0x58);                    // pop rax
+    ljit_bytes("\x48\x89\x45", 3);      // mov [rbp + disp8], rax
+    ljit_byte(ljit_arg_disp(i));
+  }
+  ljit_jump(LJIT_JMP, loop_at);
+  return 1;
+}
+
+// list evaluated as a s-expression
+static int ljit_list(lval* list, int tail, int depth) {
+  if (depth > LJIT_MAX_NESTING || list->count == 0) { return 0; }
+  if (list->count == 1) { return ljit_expr(list->cell[0], tail, depth); }
+
+  lval* head = list->cell[0];
+  if (head->type != LVAL_SYM) { return 0; }
+  lval* fn = ljit_global(head);
+  if (!fn || fn->type != LVAL_FUN) { return 0; }
+
+  if (!fn->builtin) {
+    // the arguments are already where they go, see ljit_fits
+    if (fn->body != self->body || !ljit_fits(building, fn)) { return 0; }
+    ljit_guard(building, head->sym, LGUARD_SELF)->body = self->body;
+    return ljit_self_call(list, tail, depth);
+  }
+
+  int op = fn->info->op;
+  if (op != LB_IF && (op < LB_ADD || op > LB_MOD)) { return 0; }
+  ljit_guard(building, head->sym, LGUARD_BUILTIN)->info = fn->info;
+
+  if (op == LB_IF) { return ljit_if(list, tail, depth); }
+  return ljit_arith(op, list, depth);
+}
+
+// the code the vm calls, with the arguments in an array and where to
+// find the context, followed by where it goes when it has to bail
+static void ljit_entry(void) {
+  ljit_byte(0x53);                      // push rbx
+  ljit_byte(0x55);                      // push rbp
+  ljit_bytes("\x41\x54", 2);            // push r12
+  ljit_bytes("\x41\x55", 2);            // push r13
+  ljit_bytes("\x49\x89\xf4", 3);        // mov r12, rsi
+  ljit_bytes("\x4d\x8b\x6c\x24", 4);    // mov r13, [r12 + depth]
+  ljit_byte(8 * LJIT_CTX_DEPTH);
+  ljit_bytes("\x49\x89\x24\x24", 4);    // mov [r12], rsp
+
+  for (int i = 0; i < building->arity; i++) {
+    ljit_bytes("\xff\x77", 2);          // push [rdi + disp8]
+    ljit_byte(8 * i);
+  }
+  int body = ljit_jump(LJIT_CALL, -1);
+
+  int exit_at = out_count;
+  ljit_bytes("\x41\x5d", 2);            // pop r13
+  ljit_bytes("\x41\x5c", 2);            // pop r12
+  ljit_byte(0x5d);                      // pop rbp
+  ljit_byte(0x5b);                      // pop rbx
+  ljit_byte(0xc3);                      // ret
+
+  // back to the stack as it was on the way in, however deep we are
+  bail_at = out_count;
+  ljit_bytes("\x49\x8b\x24\x24", 4);    // mov rsp, [r12]
+  ljit_bytes("\x49\xc7\x44\x24", 4);    // mov qword [r12 + bailed], 1
+  ljit_byte(8 * LJIT_CTX_BAILED);
+  ljit_int32(1);
+  // what's left of the depth, which only runs out on going too deep
+  ljit_bytes("\x4d\x89\x6c\x24", 4);    // mov [r12 + depth], r13
+  ljit_byte(8 * LJIT_CTX_DEPTH);
+  ljit_jump(LJIT_JMP, exit_at);
+
+  body_at = out_count;
+  ljit_patch(body, body_at);
+}
+
+static int ljit_body(void) {
+  ljit_byte(0x55);                      // push rbp
+  ljit_bytes("\x48\x89\xe5", 3);        // mov rbp, rsp
+  ljit_bytes("\x49\xff\xcd", 3);        // dec r13
+  ljit_jump(LJIT_JE, bail_at);
+
+  loop_at = out_count;
+  if (!ljit_list(self->body, 1, 0)) { return 0; }
+
+  ljit_bytes("\x49\xff\xc5", 3);        // inc r13
+  ljit_byte(0x5d);                      // pop rbp
+  ljit_byte(0xc2);                      // ret imm16, dropping the arguments
+  ljit_byte((8 * building->arity) & 0xff);
+  ljit_byte((8 * building->arity) >> 8);
+  return 1;
+}
+
+// native code for the user function fn, or NULL when its body isn't
+// something we can compile
+ljit* ljit_compile(lval* fn) {
+  lval* formals = fn->formals;
+  if (formals->count > LJIT_MAX_ARGS) { return NULL; }
+  for (int i = 0; i < formals->count; i++) {
+    if (formals->cell[i]->sym == lsym_rest) { return NULL; }
+  }
+
+  ljit* j = lmem_alloc(sizeof(ljit));
+  memset(j, 0, sizeof(ljit));
+  j->arity = formals->count;
+  for (int i = 0; i < formals->count; i++) { j->formals[i] = formals->cell[i]->sym; }
+  j->version = lenv_version;
+
+  // globals are all it can refer to, anything bound in between, say by
+  // a function this one was made in, is flagged LSYM_LOCAL
+  lenv* env = fn->env;
+  while (env->parent) { env = env->parent; }
+  j->root = env;
+
+  building = j;
+  self = fn;
+  out_count = 0;
+
+  ljit_entry();
+  if (!ljit_body()) {
+    ljit_free(j);
+    return NULL;
+  }
+
+  // writable while it's copied in, then only executable
+  size_t page = 4096;
+  j->size = (out_count + page - 1) / page * page;
+  void* mem = mmap(NULL, j->size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    ljit_free(j);
+    return NULL;
+  }
+  memcpy(mem, out, out_count);
+  if (mprotect(mem, j->size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, j->size);
+    ljit_free(j);
+    return NULL;
+  }
+
+  j->mem = mem;
+  j->entry = (long (*)(long*, long*))mem;
+  return j;
+}
+
+// runs the code for the arguments args, going no more than depth calls
+// deep, the result, or NULL when the vm has to do it after all, with
+// too_deep set when that's because it ran out of depth
+lval* ljit_call(ljit* j, lval* args, int depth, int* too_deep) {
+  *too_deep = 0;
+  if (args->count != j->arity || depth <= 0) { return NULL; }
+
+  long nums[LJIT_MAX_ARGS];
+  for (int i = 0; i < args->count; i++) {
+    if (args->cell[i]->type != LVAL_NUM) { return NULL; }
+    nums[i] = args->cell[i]->num;
+  }
+
+  long ctx[LJIT_CTX_SIZE] = { 0, 0, depth };
+  long result = j->entry(nums, ctx);
+  if (ctx[LJIT_CTX_BAILED]) {
+    *too_deep = ctx[LJIT_CTX_DEPTH] == 0;
+    return NULL;
+  }
+
+  return lval_num(result);
+}
+
+#else
+
+// anywhere else everything is left to the vm
+ljit* ljit_compile(lval* fn) {
+  return NULL;
+}
+
+lval* ljit_call(ljit* j, lval* args, int depth, int* too_deep) {
+  *too_deep = 0;
+  return NULL;
+}
+
+#endif
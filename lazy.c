@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// LAZINESS
+//
+//
+
+// a promise is an expression and the environment to evaluate it in, the
+// first time it's forced its value takes their place, so it's only ever
+// worked out once
+
+// a lazy sequence is its first item and a promise of the rest, which
+// gives another lazy sequence, or a q-expression, {} where it ends, only
+// as much of it as is asked for is ever worked out, and walking along one
+// nothing else holds frees what's behind as it goes
+
+// the value of v, forcing it if it's a promise, anything else is its own
+// value, doesn't take over v
+lval* lval_force(lval* v) {
+  if (v->type != LVAL_LAZY) { return lval_copy(v); }
+  if (!v->scope) { return lval_copy(v->promised); }
+
+  // anything which gets back round to it while it's being worked out
+  // finds an error in its place
+  lenv* env = v->scope;
+  lval* expr = v->promised;
+  v->scope = NULL;
+  v->promised = lval_err("promise forced again while its value was being worked out");
+
+  lval* result = lval_eval(env, lval_copy(expr));
+
+  // errors aren't kept, forcing it again tries again
+  if (result->type == LVAL_ERR) {
+    lval_del(v->promised);
+    v->promised = expr;
+    v->scope = env;
+    return result;
+  }
+
+  lval_del(v->promised);
+  v->promised = lval_copy(result);
+  lval_del(expr);
+  lenv_del(env);
+  return result;
+}
+
+// the rest of the lazy sequence seq, forcing it if need be, takes over seq
+lval* lval_seq_rest(lval* seq) {
+  lval* rest = lval_force(seq->rest);
+  lval_del(seq);
+
+  if (rest->type != LVAL_SEQ && rest->type != LVAL_QEXPR && rest->type != LVAL_ERR) {
+    lval* err = lval_err("lazy sequence went on with a %s, expected a quoted expression or lazy sequence",
+      lval_human_name(rest->type));
+    lval_del(rest);
+    return err;
+  }
+  return rest;
+}
+
+// what's left of the list or lazy sequence once n items are dropped from
+// the front, fewer if it ends first, *dropped says how many, or an error,
+// takes over list
+lval* lval_seq_drop(lval* list, long n, long* dropped) {
+  *dropped = 0;
+  while (*dropped < n && list->type == LVAL_SEQ) {
+    list = lval_seq_rest(list);
+    if (list->type == LVAL_ERR) { return list; }
+    (*dropped)++;
+  }
+  if (list->type == LVAL_SEQ) { return list; }
+
+  long k = n - *dropped < list->count ? n - *dropped : list->count;
+  *dropped += k;
+  return k ? lval_slice(list, k, list->count - k) : list;
+}
+
+// the first n items of the list or lazy sequence, fewer if it ends first,
+// as a q-expression, nothing past them is forced, takes over list
+lval* lval_seq_take(lval* list, long n) {
+  lval* taken = lval_qexpr();
+  while (taken->count < n && list->type == LVAL_SEQ) {
+    taken = lval_add(taken, lval_copy(list->first));
+    if (taken->count == n) { break; }
+
+    list = lval_seq_rest(list);
+    if (list->type == LVAL_ERR) {
+      lval_del(taken);
+      return list;
+    }
+  }
+
+  if (list->type == LVAL_QEXPR) {
+    long k = n - taken->count < list->count ? n - taken->count : list->count;
+    if (taken->count == 0) {
+      lval_del(taken);
+      return lval_slice(list, 0, k);
+    }
+    taken = lval_splice(taken, taken->count, lval_slice(list, 0, k));
+  } else {
+    lval_del(list);
+  }
+  return taken;
+}
@@ -2,11 +2,229 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
 #include "mpc.h"
 #include "lispy.h"
 #include "lib.h"
 
+//
+//
+// calling builtins
+//
+//
+
+static int lbuiltin_type(char c) {
+  switch (c) {
+    case 'n':
+    case 'r':
+    case 'v': return LVAL_NUM;
+    case 's': return LVAL_STR;
+    case 'm': return LVAL_MAP;
+    case 'q':
+    case 'l': return LVAL_QEXPR;
+    default: return -1;
+  }
+}
+
+// checks the arguments against what the builtin says it takes, gives
+// NULL when they're fine, or the error, having deleted them
+static lval* lbuiltin_check(lbuiltin_info* b, lval* a) {
+  if (a->count < b->min || (b->max != -1 && a->count > b->max)) {
+    lval* err;
+    if (b->min == b->max) {
+      err = lval_err("Function '%s', receive wrong number of arguments! %i for %i",
+        b->name, a->count, b->min);
+    } else if (b->max == -1) {
+      err = lval_err("Function '%s', receive wrong number of arguments! %i for at least %i",
+        b->name, a->count, b->min);
+    } else {
+      err = lval_err("Function '%s', receive wrong number of arguments! %i for %i to %i",
+        b->name, a->count, b->min, b->max);
+    }
+    lval_del(a);
+    return err;
+  }
+
+  if (!b->types) { return NULL; }
+
+  int last = strlen(b->types) - 1;
+  for (int i = 0; i < a->count; i++) {
+    char c = b->types[i < last ? i : last];
+    int t = a->cell[i]->type;
+    if (c == 'l' && (t == LVAL_SEQ || t == LVAL_VEC)) { continue; }
+    if ((c == 'r' || c == 'v') && (t == LVAL_DBL || t == LVAL_BIG)) { continue; }
+    if (c == 'v' && t == LVAL_VEC) { continue; }
+    LASSERT(a, c != 'n' || t != LVAL_BIG,
+      "Function '%s', passed a number too big for it at argument index %i",
+      b->name, i);
+
+    int expected = lbuiltin_type(c);
+    if (expected != -1) {
+      LASSERT_TYPE(b->name, a, i, expected);
+    }
+  }
+  return NULL;
+}
+
+// x ^ y, a negative y truncated towards zero, gives 0 when it overflows
+static int lnum_pow(long x, long y, long* out) {
+  if (y < 0) {
+    if (x == 0) { return 0; }
+    *out = (x == 1 || x == -1) ? ((y & 1) ? x : 1) : 0;
+    return 1;
+  }
+
+  long r = 1;
+  for (;;) {
+    if ((y & 1) && __builtin_mul_overflow(r, x, &r)) { return 0; }
+    y >>= 1;
+    if (!y) { break; }
+    if (__builtin_mul_overflow(x, x, &x)) { return 0; }
+  }
+  *out = r;
+  return 1;
+}
+
+// x op y for the arithmetic ops, gives 0 when it would divide by zero or
+// the result won't fit in a long, both of which builtin_op sees to
+int lnum_arith(int op, long x, long y, long* out) {
+  long z;
+  switch (op) {
+    case LB_ADD: if (__builtin_add_overflow(x, y, &z)) { return 0; } break;
+    case LB_SUB: if (__builtin_sub_overflow(x, y, &z)) { return 0; } break;
+    case LB_MUL: if (__builtin_mul_overflow(x, y, &z)) { return 0; } break;
+    case LB_DIV:
+      if (y == 0 || (x == LONG_MIN && y == -1)) { return 0; }
+      z = x / y;
+      break;
+    case LB_MOD:
+      if (y == 0) { return 0; }
+      z = (y == -1) ? 0 : x % y;
+      break;
+    case LB_POW: if (!lnum_pow(x, y, &z)) { return 0; } break;
+    default: return 0;
+  }
+  *out = z;
+  return 1;
+}
+
+// the same for floats, where % is fmod and ^ is pow, gives 0 when it
+// would divide by zero or the result isn't finite, inf and nan are never
+// values, the same as for sqrt, log and exp, see lnum_dbl_err for which
+int lnum_arith_dbl(int op, double x, double y, double* out) {
+  switch (op) {
+    case LB_ADD: *out = x + y; break;
+    case LB_SUB: *out = x - y; break;
+    case LB_MUL: *out = x * y; break;
+    case LB_DIV:
+      if (y == 0) { return 0; }
+      *out = x / y;
+      break;
+    case LB_MOD:
+      if (y == 0) { return 0; }
+      *out = fmod(x, y);
+      break;
+    case LB_POW: *out = pow(x, y); break;
+  }
+  return isfinite(*out);
+}
+
+// whether x op y has no result for dividing by zero, 0 ^ -1 being 1 / 0
+int lnum_div_zero(int op, double x, double y) {
+  return ((op == LB_DIV || op == LB_MOD) && y == 0) || (op == LB_POW && x == 0 && y < 0);
+}
+
+// the error for x op y once lnum_arith_dbl has found there's no result
+lval* lnum_dbl_err(int op, double x, double y) {
+  if (lnum_div_zero(op, x, y)) { return lval_err("Division by Zero!"); }
+  return lval_err("Float result out of range!");
+}
+
+int lnum_compare(int op, long x, long y) {
+  switch (op) {
+    case LB_GT:  return x > y;
+    case LB_LT:  return x < y;
+    case LB_GTE: return x >= y;
+    case LB_LTE: return x <= y;
+    case LB_EQ:  return x == y;
+    case LB_NEQ: return x != y;
+  }
+  return 0;
+}
+
+int lnum_compare_dbl(int op, double x, double y) {
+  switch (op) {
+    case LB_GT:  return x > y;
+    case LB_LT:  return x < y;
+    case LB_GTE: return x >= y;
+    case LB_LTE: return x <= y;
+    case LB_EQ:  return x == y;
+    case LB_NEQ: return x != y;
+  }
+  return 0;
+}
+
+// a number, big number or float, as a float
+double lnum_dbl(lval* v) {
+  switch (v->type) {
+    case LVAL_DBL: return v->dbl;
+    case LVAL_BIG: return lbig_dbl(v);
+  }
+  return (double)v->num;
+}
+
+// whether any of the n values is a float, so the lot should be
+int lnum_any_dbl(lval** args, int n) {
+  for (int i = 0; i < n; i++) {
+    if (args[i]->type == LVAL_DBL) { return 1; }
+  }
+  return 0;
+}
+
+// the float d as a new reference, written over one of the n operands it
+// was worked out from if nothing else holds that, so a float loop doesn't
+// allocate at every step, the operands are still the caller's to delete
+lval* lnum_dbl_into(lval** args, int n, double d) {
+  for (int i = 0; i < n; i++) {
+    if (args[i]->type == LVAL_DBL && args[i]->refs == 1) {
+      args[i]->dbl = d;
+      return lval_copy(args[i]);
+    }
+  }
+  return lval_dbl(d);
+}
+
+// calls the builtin fn with the arguments a, once they've been checked,
+// arithmetic and comparisons of two numbers are done here and then
+lval* lbuiltin_call(lenv* env, lval* fn, lval* a) {
+  lbuiltin_info* b = fn->info;
+
+  lval* err = lbuiltin_check(b, a);
+  if (err) { return err; }
+
+  // the table says these only take numbers, floats are left to the builtin
+  if (b->op >= LB_ADD && b->op <= LB_NEQ && a->count == 2 &&
+      a->cell[0]->type == LVAL_NUM && a->cell[1]->type == LVAL_NUM) {
+    long x = a->cell[0]->num;
+    long y = a->cell[1]->num;
+    long z;
+
+    if (b->op >= LB_GT) {
+      lval_del(a);
+      return lval_bool(lnum_compare(b->op, x, y));
+    }
+
+    // dividing by zero is left to the builtin to report
+    if (lnum_arith(b->op, x, y, &z)) {
+      lval_del(a);
+      return lval_num(z);
+    }
+  }
+
+  return b->fn(env, a);
+}
+
 //
 //
 // create types
@@ -17,14 +235,12 @@
 // changes the type of an lval to a quoted expression
 //
 lval* builtin_quote(lenv* env, lval* a) {
+  a = lval_own(a);
   a->type = LVAL_QEXPR;
   return a;
 }
 
 lval* builtin_error(lenv* e, lval* a) {
-  LASSERT_ARITY("error", a, 1);
-  LASSERT_TYPE("error", a, 0, LVAL_STR);
-
   /* Construct Error from first argument */
   lval* err = lval_err(a->cell[0]->str);
 
@@ -35,28 +251,31 @@ lval* builtin_error(lenv* e, lval* a) {
 
 // straight copied then modified
 lval* builtin_head(lenv* env, lval* a) {
-  LASSERT_ARITY("head", a, 1);
-  LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
-  LASSERT(a, a->cell[0]->count != 0, "Function 'head' passed {}!");
-
-  lval* v = lval_take(a, 0);
-
-  while (v->count > 1) {
-    lval_del(lval_pop(v, 1));
+  if (a->cell[0]->type == LVAL_SEQ) {
+    return lval_seq_take(lval_take(a, 0), 1);
+  }
+  if (a->cell[0]->type == LVAL_VEC) {
+    LASSERT(a, a->cell[0]->vec_count != 0, "Function 'head' passed []!");
+    lval* v = lvec_slice(a->cell[0], 0, 1);
+    lval_del(a);
+    return v;
   }
 
-  return v;
+  LASSERT(a, a->cell[0]->count != 0, "Function 'head' passed {}!");
+
+  return lval_head(lval_take(a, 0));
 }
 
 // straight copied then modified
 lval* builtin_join(lenv* env, lval* a) {
+  lval* x = lval_own(lval_pop(a, 0));
 
+  // make room for everything up front
+  int total = 0;
   for (int i = 0; i < a->count; i++) {
-    LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
-      "Function 'join' passed incorrect type.");
+    total += a->cell[i]->count;
   }
-
-  lval* x = lval_pop(a, 0);
+  lval_reserve(x, total);
 
   while (a->count) {
     x = lval_join(x, lval_pop(a, 0));
@@ -70,25 +289,72 @@ lval* builtin_join(lenv* env, lval* a) {
 // removes the first item of a quoted expression
 //
 lval* builtin_tail(lenv* env, lval* a) {
-  LASSERT(a, a->count == 1,
-    "Function 'tail' passed too many arguments!");
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-    "Function 'tail' passed incorrect type!");
+  if (a->cell[0]->type == LVAL_SEQ) {
+    return lval_seq_rest(lval_take(a, 0));
+  }
+  if (a->cell[0]->type == LVAL_VEC) {
+    long n = a->cell[0]->vec_count;
+    LASSERT(a, n != 0, "Function 'tail' passed []!");
+    lval* v = lvec_slice(a->cell[0], 1, n - 1);
+    lval_del(a);
+    return v;
+  }
+
   LASSERT(a, a->cell[0]->count != 0,
     "Function 'tail' passed {}!");
 
-  lval* v = lval_take(a, 0);
-  lval_del(lval_pop(v, 0));
-  return v;
+  return lval_tail(lval_take(a, 0));
+}
+
+// slice start count list, the sublist of count items from index start
+lval* builtin_slice(lenv* env, lval* a) {
+  long start = a->cell[0]->num;
+  long count = a->cell[1]->num;
+
+  LASSERT(a, start >= 0 && count >= 0 && start + count <= a->cell[2]->count,
+    "Function 'slice', %li items from index %li are out of bounds "
+    "for a list of length %i", count, start, a->cell[2]->count);
+
+  return lval_slice(lval_take(a, 2), start, count);
 }
 
 lval* builtin_nth(lenv* env, lval* a) {
-  LASSERT_ARITY("length", a, 2);
-  LASSERT_TYPE("length", a, 0, LVAL_NUM);
-  LASSERT_TYPE("length", a, 1, LVAL_QEXPR);
+  // a lazy sequence is walked along, forcing as much as it takes
+  if (a->cell[1]->type == LVAL_SEQ) {
+    long n = a->cell[0]->num;
+    LASSERT(a, n >= 0, "out of bounds error tried to get list item at index %li", n);
+
+    long dropped;
+    lval* rest = lval_seq_drop(lval_take(a, 1), n, &dropped);
+    if (rest->type == LVAL_ERR) { return rest; }
+
+    if (rest->type == LVAL_SEQ) {
+      lval* nth = lval_copy(rest->first);
+      lval_del(rest);
+      return nth;
+    }
+    if (rest->count == 0) {
+      lval_del(rest);
+      return lval_err("out of bounds error tried to get list "
+                      "item at index %li but length is only %li", n, dropped);
+    }
+    return lval_take(rest, 0);
+  }
+
+  if (a->cell[1]->type == LVAL_VEC) {
+    long n = a->cell[0]->num;
+    lval* v = a->cell[1];
+    LASSERT(a, n >= 0 && n < v->vec_count,
+      "out of bounds error tried to get vector item at index %li "
+      "but length is only %li", n, v->vec_count);
+
+    lval* nth = lvec_nth(v, n);
+    lval_del(a);
+    return nth;
+  }
 
   // make sure it can exists
-  if (a->cell[1]->count < a->cell[0]->num) {
+  if (a->cell[0]->num < 0 || a->cell[1]->count <= a->cell[0]->num) {
     lval* err = lval_err("out of bounds error tried to get list"
                   "item at index %i but length is only %i",
                   a->cell[0]->num, a->cell[1]->count);
@@ -104,58 +370,115 @@ lval* builtin_nth(lenv* env, lval* a) {
 }
 
 lval* builtin_length(lenv* env, lval* a) {
-  LASSERT_ARITY("length", a, 1);
-  LASSERT_TYPE("length", a, 0, LVAL_QEXPR);
+  // the whole of a lazy sequence has to be worked out to count it, so
+  // one that goes on for ever never comes back
+  if (a->cell[0]->type == LVAL_SEQ) {
+    long n;
+    lval* rest = lval_seq_drop(lval_take(a, 0), LONG_MAX, &n);
+    if (rest->type == LVAL_ERR) { return rest; }
+    lval_del(rest);
+    return lval_num(n);
+  }
 
-  lval* n = lval_num(a->cell[0]->count);
+  lval* v = a->cell[0];
+  lval* n = lval_num(v->type == LVAL_VEC ? v->vec_count : v->count);
   lval_del(a);
 
   return n;
 }
 
+// take n list, a list of the first n items of a list or lazy sequence,
+// or all of them if there are fewer
+lval* builtin_take(lenv* env, lval* a) {
+  long n = a->cell[0]->num;
+  LASSERT(a, n >= 0, "Function 'take' passed %li, expected 0 or more items", n);
+
+  lval* v = a->cell[1];
+  if (v->type == LVAL_VEC) {
+    v = lvec_slice(v, 0, n < v->vec_count ? n : v->vec_count);
+    lval_del(a);
+    return v;
+  }
+
+  return lval_seq_take(lval_take(a, 1), n);
+}
+
 lval* builtin_cons(lenv* env, lval* args) {
-  LASSERT(args, args->cell[0]->type == LVAL_QEXPR,
-    "Error! Functon 'cons' must be passed a quoted expression\n"
-    "But was passed a %s", lval_human_name(args->cell[0]->type));
+  lval* list = lval_pop(args, 0);
+
+  // each item goes on the front in turn, so the last one given ends up
+  // first, flip them round and splice them all in at once
+  for (int i = 0, j = args->count - 1; i < j; i++, j--) {
+    lval* tmp = args->cell[i];
+    args->cell[i] = args->cell[j];
+    args->cell[j] = tmp;
+  }
 
-  lval* list = lval_copy(args->cell[0]);
+  return lval_splice(list, 0, args);
+}
+
+// special forms are handed their operands as they were written, and only
+// read them, see LB_SPECIAL
 
-  while (args->count > 1) {
-    list = lval_unshift(list, lval_copy(lval_pop(args, 1)));
+// the value of each operand in turn, or the first error, takes over a
+static lval* lspecial_eval_all(lenv* env, lval* a) {
+  lval* values = lval_sexpr();
+  lval_reserve(values, a->count);
+  for (int i = 0; i < a->count; i++) {
+    lval* v = lval_eval(env, lval_copy(a->cell[i]));
+    if (v->type == LVAL_ERR) {
+      lval_del(values);
+      lval_del(a);
+      return v;
+    }
+    values->cell[values->count++] = v;
   }
+  lval_del(a);
+  return values;
+}
 
-  lval_del(args);
+// the value of the operand v, a quoted expression, or an error
+static lval* lspecial_eval_qexpr(lenv* env, char* name, lval* v, int index) {
+  v = lval_eval(env, lval_copy(v));
+  if (v->type == LVAL_ERR || v->type == LVAL_QEXPR) { return v; }
 
-  return list;
+  lval* err = lval_err("Function '%s', passed an unexpected type, you passed a %s at argument index %i when a %s was expected",
+    name, lval_human_name(v->type), index, lval_human_name(LVAL_QEXPR));
+  lval_del(v);
+  return err;
 }
 
-lval* builtin_and(lenv* env, lval* a) {
-  LASSERT_ARITY("&&", a, 2);
+// && and || only evaluate as far as it takes to know the answer, which
+// is stop, the value it's worked out when one of them is
+static lval* lspecial_logic(lenv* env, lval* a, int stop) {
+  for (int i = 0; i < a->count; i++) {
+    lval* x = lval_eval(env, lval_copy(a->cell[i]));
+    if (x->type == LVAL_ERR) {
+      lval_del(a);
+      return x;
+    }
 
-  if (lval_true(a->cell[0]) && lval_true(a->cell[1])) {
-    lval_del(a);
-    return lval_bool(1);
-  } else {
-    lval_del(a);
-    return lval_bool(0);
+    int truthy = lval_true(x);
+    lval_del(x);
+    if (truthy == stop) {
+      lval_del(a);
+      return lval_bool(stop);
+    }
   }
+
+  lval_del(a);
+  return lval_bool(!stop);
 }
 
-lval* builtin_or(lenv* env, lval* a) {
-  LASSERT_ARITY("||", a, 2);
+lval* builtin_and(lenv* env, lval* a) {
+  return lspecial_logic(env, a, 0);
+}
 
-  if (lval_true(a->cell[0]) || lval_true(a->cell[1])) {
-    lval_del(a);
-    return lval_bool(1);
-  } else {
-    lval_del(a);
-    return lval_bool(0);
-  }
+lval* builtin_or(lenv* env, lval* a) {
+  return lspecial_logic(env, a, 1);
 }
 
 lval* builtin_not(lenv* env, lval* a) {
-  LASSERT_ARITY("!", a, 1);
-
   if (lval_true(a->cell[0])) {
     lval_del(a);
     return lval_bool(0);
@@ -166,76 +489,158 @@ lval* builtin_not(lenv* env, lval* a) {
 }
 
 lval* builtin_if(lenv* env, lval* a) {
-
-  // verify the if block
-  LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
-
-  if (a->count == 3) {
-    // verify the else block
-    LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
+  // is the condition truthy?
+  lval* cond = lval_eval(env, lval_copy(a->cell[0]));
+  if (cond->type == LVAL_ERR) {
+    lval_del(a);
+    return cond;
   }
+  int truthy = lval_true(cond);
+  lval_del(cond);
 
-  if (a->count > 3) {
+  // if no else condition was provided, free the arguments and return false
+  if (!truthy && a->count == 2) {
     lval_del(a);
-    return lval_err("Too many argument provided to if");
+    return lval_bool(0);
   }
 
-  // is the condition truthy?
-  if (lval_true(lval_pop(a, 0))) {
+  // only the block taken is looked at
+  int taken = truthy ? 1 : 2;
+  lval* x = lspecial_eval_qexpr(env, "if", a->cell[taken], taken);
+  lval_del(a);
+  if (x->type == LVAL_ERR) { return x; }
+
+  // the evaluated block is our value, which the caller works out, it may
+  // well be shared with a function body, so it's left as it is
+  return lval_defer(x);
+}
 
-    // pop off the block to evaluate
-    lval* x = lval_pop(a, 0);
+// do a b c, evaluates each in turn, the last is its value
+lval* builtin_do(lenv* env, lval* a) {
+  for (int i = 0; i < a->count - 1; i++) {
+    lval* x = lval_eval(env, lval_copy(a->cell[i]));
+    if (x->type == LVAL_ERR) {
+      lval_del(a);
+      return x;
+    }
+    lval_del(x);
+  }
 
-    // mark it ready to be called
-    x->type = LVAL_SEXPR;
+  // which the caller works out, when there's any work to it
+  lval* last = lval_copy(a->cell[a->count - 1]);
+  lval_del(a);
+  if (last->type == LVAL_SEXPR) { return lval_defer(last); }
+  return lval_eval(env, last);
+}
 
-    // delete the remaining arguments
+// let {x 1 y (+ x 1)} {body}, evaluates body in a frame of its own, where
+// each symbol is bound to the value of what follows it, in turn, so each
+// can see those before it
+lval* builtin_let(lenv* env, lval* a) {
+  lval* binds = lspecial_eval_qexpr(env, "let", a->cell[0], 0);
+  if (binds->type == LVAL_ERR) {
     lval_del(a);
+    return binds;
+  }
+  lval* body = lspecial_eval_qexpr(env, "let", a->cell[1], 1);
+  lval_del(a);
+  if (body->type == LVAL_ERR) {
+    lval_del(binds);
+    return body;
+  }
 
-    // return the evaluated block
-    return lval_eval(env, x);
+  lval* err = NULL;
+  if (binds->count % 2) {
+    err = lval_err("Function 'let' passed %i items to bind, expected symbols each followed by a value", binds->count);
+  }
+  for (int i = 0; !err && i < binds->count; i += 2) {
+    if (binds->cell[i]->type != LVAL_SYM) {
+      err = lval_err("Function 'let' passed a %s at index %i to bind, expected a symbol",
+        lval_human_name(binds->cell[i]->type), i);
+    }
+  }
+  if (err) {
+    lval_del(binds);
+    lval_del(body);
+    return err;
+  }
 
-  } else {
-    // falsy? then free if block
-    lval_del(lval_pop(a, 0));
+  lenv* frame = lenv_new();
+  frame->parent = lenv_copy(env);
 
-    // if there is an else block, evaluate that
-    if (a->count == 1) {
-      lval* x = lval_pop(a, 0);
-      x->type = LVAL_SEXPR;
-      lval_del(a);
-      return lval_eval(env, x);
+  for (int i = 0; i < binds->count; i += 2) {
+    lval* v = lval_eval(frame, lval_copy(binds->cell[i + 1]));
+    if (v->type == LVAL_ERR) {
+      lval_del(binds);
+      lval_del(body);
+      lenv_del(frame);
+      return v;
     }
 
-    // if no else condition was provided, free the arguments and return false
-    lval_del(a);
-    return lval_bool(0);
+    // it may shadow a global something has counted on
+    lsym_varies(binds->cell[i]->sym);
+    lenv_put(frame, binds->cell[i], v);
+    lval_del(v);
   }
+
+  lval_del(binds);
+  return lval_defer_in(frame, body);
 }
 
-// switch from QEXPR -> SEXPR and evaluate a child
-lval* builtin_eval(lenv* env, lval* a) {
-  LASSERT_ARITY("eval", a, 1);
-  LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+// a promise to evaluate the expression where we are, when it's forced
+lval* builtin_delay(lenv* env, lval* a) {
+  lval* x = lval_own(lval_take(a, 0));
+  x->type = LVAL_SEXPR;
+
+  return lval_lazy(env, x);
+}
+
+lval* builtin_force(lenv* env, lval* a) {
+  lval* v = lval_force(a->cell[0]);
+  lval_del(a);
+  return v;
+}
 
-  lval* x = lval_take(a, 0);
+// lazy-cons x {rest}, the lazy sequence of x followed by whatever rest
+// evaluates to, a lazy sequence or a list, once it's asked for
+lval* builtin_lazy_cons(lenv* env, lval* a) {
+  lval* x = lval_own(lval_pop(a, 1));
   x->type = LVAL_SEXPR;
 
-  return lval_eval(env, x);
+  return lval_seq(lval_take(a, 0), lval_lazy(env, x));
+}
+
+// evaluate a quoted expression as a s-expression, see lval_defer
+lval* builtin_eval(lenv* env, lval* a) {
+  return lval_defer(lval_take(a, 0));
+}
+
+// x compared with y, for numbers, big numbers and floats alike
+static int lnum_compare_any(int op, lval* x, lval* y) {
+  if (x->type == LVAL_NUM && y->type == LVAL_NUM) {
+    return lnum_compare(op, x->num, y->num);
+  }
+  if (x->type == LVAL_DBL || y->type == LVAL_DBL) {
+    return lnum_compare_dbl(op, lnum_dbl(x), lnum_dbl(y));
+  }
+  return lbig_compare(op, x, y);
 }
 
 lval* builtin_min(lenv* env, lval* a) {
+  if (lvec_any(a->cell, a->count)) { return lvec_op(a, LB_MIN); }
 
   lval* x = lval_pop(a, 0);
 
+  // keep whichever is smaller, rather than writing into a shared value
   while(a->count > 0) {
     lval* y = lval_pop(a, 0);
 
-    if (x->num > y->num) {
-      x->num = y->num;
+    if (lnum_compare_any(LB_LT, y, x)) {
+      lval_del(x);
+      x = y;
+    } else {
+      lval_del(y);
     }
-
-    lval_del(y);
   }
 
   lval_del(a);
@@ -243,95 +648,65 @@ lval* builtin_min(lenv* env, lval* a) {
 }
 
 lval* builtin_max(lenv* env, lval* a) {
+  if (lvec_any(a->cell, a->count)) { return lvec_op(a, LB_MAX); }
+
   lval* x = lval_pop(a, 0);
 
   while(a->count > 0) {
     lval* y = lval_pop(a, 0);
 
-    if (y->num > x->num) {
-      x->num = y->num;
+    if (lnum_compare_any(LB_LT, x, y)) {
+      lval_del(x);
+      x = y;
+    } else {
+      lval_del(y);
     }
-
-    lval_del(y);
   }
 
   lval_del(a);
   return x;
 }
 
-lval* builtin_compare(lenv* env, lval* a, char *op) {
-  LASSERT_ARITY(op, a, 2);
-  LASSERT_TYPE(op, a, 0, LVAL_NUM);
-  LASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-  int b;
-
-  // equals and it equals, true
-  if ((strcmp(op, "==") == 0) && (a->cell[0]->num == a->cell[1]->num))  { b = 1; }
-  // equals and it doesnt equal, false
-  if ((strcmp(op, "==") == 0) && (a->cell[0]->num != a->cell[1]->num))  { b = 0; }
-  // doesn't equal and it doesnt equal, true
-  if ((strcmp(op, "!=") == 0) && (a->cell[0]->num != a->cell[1]->num))  { b = 1; }
-  // doesn't equal and it does equal, false
-  if ((strcmp(op, "!=") == 0) && (a->cell[0]->num == a->cell[1]->num))  { b = 0; }
-
-  // gt and is gt, true
-  if ((strcmp(op, ">") == 0) && (a->cell[0]->num > a->cell[1]->num))  { b = 1; }
-  // gt and is not gt, false
-  if ((strcmp(op, ">") == 0) && (a->cell[0]->num < a->cell[1]->num))  { b = 0; }
-
-  // gte and is gte, true
-  if ((strcmp(op, ">=") == 0) && (a->cell[0]->num >= a->cell[1]->num))  { b = 1; }
-  // gte and is not gte, false
-  if ((strcmp(op, ">=") == 0) && (!(a->cell[0]->num >= a->cell[1]->num)))  { b = 0; }
-
-  // lt and is lt, true
-  if ((strcmp(op, "<") == 0) && (a->cell[0]->num < a->cell[1]->num))  { b = 1; }
-  // lt and is not lt, false
-  if ((strcmp(op, "<") == 0) && (a->cell[0]->num > a->cell[1]->num))  { b = 0; }
-
-  // lte and is lte, true
-  if ((strcmp(op, "<=") == 0) && (a->cell[0]->num <= a->cell[1]->num))  { b = 1; }
-  // lte and is not lte, false
-  if ((strcmp(op, "<=") == 0) && (!(a->cell[0]->num <= a->cell[1]->num)))  { b = 0; }
-
+lval* builtin_compare(lenv* env, lval* a, int op) {
+  if (lvec_any(a->cell, 2)) { return lvec_compare(a, op); }
 
+  int b = lnum_compare_any(op, a->cell[0], a->cell[1]);
   lval_del(a);
   return lval_bool(b);
 }
 
 lval* builtin_gt(lenv* env, lval* a) {
-  return builtin_compare(env, a, ">");
+  return builtin_compare(env, a, LB_GT);
 }
 lval* builtin_lt(lenv* env, lval* a) {
-  return builtin_compare(env, a, "<");
+  return builtin_compare(env, a, LB_LT);
 }
 lval* builtin_gte(lenv* env, lval* a) {
-  return builtin_compare(env, a, ">=");
+  return builtin_compare(env, a, LB_GTE);
 }
 lval* builtin_lte(lenv* env, lval* a) {
-  return builtin_compare(env, a, "<=");
+  return builtin_compare(env, a, LB_LTE);
 }
 lval* builtin_eq(lenv* env, lval* a) {
-  return builtin_compare(env, a, "==");
+  return builtin_compare(env, a, LB_EQ);
 }
 lval* builtin_neq(lenv* env, lval* a) {
-  return builtin_compare(env, a, "!=");
+  return builtin_compare(env, a, LB_NEQ);
 }
 
 lval* builtin_def(lenv* env, lval* a) {
-  return builtin_var(env, a, "def");
+  return builtin_var(env, a, lsym_def);
 }
 lval* builtin_put(lenv* env, lval* a) {
-  return builtin_var(env, a, "=");
+  return builtin_var(env, a, lsym_put);
 }
 
 // add variables to the environment
 lval* builtin_var(lenv* env, lval* args, char *op) {
-  // we can only process quoted expressions unfortunately atm
-  // because anything else will be evaluated
-  LASSERT(args, args->cell[0]->type == LVAL_QEXPR,
-    "'%s' passed an unquoted expression!", op);
+  // the names may be worked out too, as 'fun' does
+  args = lspecial_eval_all(env, args);
+  if (args->type == LVAL_ERR) { return args; }
+  LASSERT_TYPE(op, args, 0, LVAL_QEXPR);
 
   // grab the references (var names)
   lval* refs = args->cell[0];
@@ -349,90 +724,240 @@ lval* builtin_var(lenv* env, lval* args, char *op) {
   // iterate over and assign
   for (int i = 0; i < refs->count; i++) {
     // global
-    if (strcmp(op, "def") == 0) {
+    if (op == lsym_def) {
       lenv_def(env, refs->cell[i], args->cell[i+1]);
     }
 
-    // local
-    if (strcmp(op, "=") == 0) {
+    // local, which may shadow a global something has counted on
+    if (op == lsym_put) {
+      if (env->parent) { lsym_varies(refs->cell[i]->sym); }
       lenv_put(env, refs->cell[i], args->cell[i+1]);
     }
   }
 
   lval_del(args);
-  return lval_sexpr();
+  return lval_nil();
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
+// builtin_op, once any of the operands is a float
+static lval* builtin_op_dbl(lval* a, int op) {
+  double x = lnum_dbl(a->cell[0]);
+  if ((op == LB_SUB) && (a->count == 1)) {
+    x = -x;
+  }
 
-  lval* x = lval_pop(a, 0);
+  for (int i = 1; i < a->count; i++) {
+    double y = lnum_dbl(a->cell[i]), z;
+    if (!lnum_arith_dbl(op, x, y, &z)) {
+      lval_del(a);
+      return lnum_dbl_err(op, x, y);
+    }
+    x = z;
+  }
 
-  // check for single argument and negation operator,
-  // this is really because we have an overloaded symbol, right?
-  if ((strcmp(op, "-") == 0) && (a->count == 0)) {
-    // return in place
-    x->num = -x->num;
+  lval* v = lnum_dbl_into(a->cell, a->count, x);
+  lval_del(a);
+  return v;
+}
+
+// builtin_op, carried on from operand i once the result so far, x, has
+// gone past what a long holds, or the operands have
+static lval* builtin_op_big(lval* a, int op, lval* x, int i) {
+  for (; i < a->count && x->type != LVAL_ERR; i++) {
+    lval* y = lbig_arith(op, x, a->cell[i]);
+    lval_del(x);
+    x = y;
   }
 
-  while(a->count > 0) {
+  lval_del(a);
+  return x;
+}
 
-    lval* y = lval_pop(a, 0);
+lval* builtin_op(lenv* e, lval* a, int op) {
+  if (lvec_any(a->cell, a->count)) { return lvec_op(a, op); }
+  if (lnum_any_dbl(a->cell, a->count)) { return builtin_op_dbl(a, op); }
 
-    // math
-    if (strcmp(op, "+") == 0) { x->num = (x->num + y->num); }
-    if (strcmp(op, "-") == 0) { x->num = (x->num - y->num); }
-    if (strcmp(op, "*") == 0) { x->num = (x->num * y->num); }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        // free these immediately, we're stopping execution
-        lval_del(x);
-        lval_del(y);
-
-        // stamp the reference
-        x = lval_err("Division by Zero!");
-        break;
-      }
-
-      // okay we can divide...
-      x->num = x->num / y->num;
-    }
-    if (strcmp(op, "\%") == 0) {  x->num = (x->num % y->num); }
-    if (strcmp(op, "^") == 0)  {  x->num = (powl(x->num, y->num)); }
+  if (a->cell[0]->type == LVAL_BIG) {
+    lval* x = (op == LB_SUB && a->count == 1)
+      ? lbig_neg(a->cell[0]) : lval_copy(a->cell[0]);
+    return builtin_op_big(a, op, x, 1);
+  }
 
-    // for all these ops we need to discard the argument as
-    // we've applied it already and reduced into x
-    lval_del(y);
+  // reduce into a plain long, the operands may well be shared values
+  long x = a->cell[0]->num;
 
+  // check for single argument and negation operator,
+  // this is really because we have an overloaded symbol, right?
+  if ((op == LB_SUB) && (a->count == 1)) {
+    if (x == LONG_MIN) { return builtin_op_big(a, op, lbig_neg(a->cell[0]), 1); }
+    x = -x;
+  }
+
+  for (int i = 1; i < a->count; i++) {
+    if (a->cell[i]->type != LVAL_NUM || !lnum_arith(op, x, a->cell[i]->num, &x)) {
+      // dividing by zero among them, which lbig_arith reports
+      return builtin_op_big(a, op, lval_num(x), i);
+    }
   }
 
-  // the expression passed in has been reduced to just x, so we can return that, and free a;
+  // the expression passed in has been reduced to just x, so free a;
   lval_del(a);
 
-  return x;
+  return lval_num(x);
 }
 
 lval* builtin_add(lenv* e, lval* a) {
-  return builtin_op(e, a, "+");
+  return builtin_op(e, a, LB_ADD);
 }
 
 lval* builtin_sub(lenv* e, lval* a) {
-  return builtin_op(e, a, "-");
+  return builtin_op(e, a, LB_SUB);
 }
 
 lval* builtin_mul(lenv* e, lval* a) {
-  return builtin_op(e, a, "*");
+  return builtin_op(e, a, LB_MUL);
 }
 
 lval* builtin_div(lenv* e, lval* a) {
-  return builtin_op(e, a, "/");
+  return builtin_op(e, a, LB_DIV);
 }
 
 lval* builtin_mod(lenv* e, lval* a) {
-  return builtin_op(e, a, "\%");
+  return builtin_op(e, a, LB_MOD);
 }
 
 lval* builtin_exp(lenv* e, lval* a) {
-  return builtin_op(e, a, "^");
+  return builtin_op(e, a, LB_POW);
+}
+
+// the float fn gives for a's only argument, anything fn isn't defined
+// for, or which would be too big to hold, is an error
+static lval* builtin_math(lval* a, char* name, double (*fn)(double)) {
+  double x = lnum_dbl(a->cell[0]);
+  LASSERT(a, isfinite(x),
+    "Function '%s', passed a number too big for it at argument index 0", name);
+  double y = fn(x);
+  lval_del(a);
+  if (!isfinite(y)) {
+    return lval_err("Function '%s' passed %g, which is out of its range!", name, x);
+  }
+  return lval_dbl(y);
+}
+
+lval* builtin_sqrt(lenv* e, lval* a) {
+  return builtin_math(a, "sqrt", sqrt);
+}
+
+lval* builtin_log(lenv* e, lval* a) {
+  return builtin_math(a, "log", log);
+}
+
+lval* builtin_exp_e(lenv* e, lval* a) {
+  return builtin_math(a, "exp", exp);
+}
+
+// the largest whole number no greater than x, as a number, or a big one
+lval* builtin_floor(lenv* e, lval* a) {
+  if (a->cell[0]->type == LVAL_NUM) { return lval_take(a, 0); }
+
+  if (a->cell[0]->type == LVAL_BIG) { return lval_take(a, 0); }
+
+  double x = floor(a->cell[0]->dbl);
+  LASSERT(a, isfinite(x),
+    "Function 'floor' passed %g, which is out of its range!", x);
+  lval_del(a);
+
+  // LONG_MAX isn't a double, but 2^63 is, and is just out of range
+  if (x >= (double)LONG_MIN && x < -(double)LONG_MIN) { return lval_num((long)x); }
+  return lbig_of_dbl(x);
+}
+
+// vec {numbers}, the numbers and floats in a vector
+lval* builtin_vec(lenv* e, lval* a) {
+  return lvec_of_list(lval_take(a, 0));
+}
+
+// vec-range n, [0 1 ... n-1]
+lval* builtin_vec_range(lenv* e, lval* a) {
+  long n = a->cell[0]->num;
+  LASSERT(a, n >= 0, "Function 'vec-range' passed %li, expected 0 or more", n);
+  lval_del(a);
+  return lvec_range(n);
+}
+
+// vec-list v, the elements of v as a q-expression
+lval* builtin_vec_list(lenv* e, lval* a) {
+  LASSERT_TYPE("vec-list", a, 0, LVAL_VEC);
+  lval* list = lvec_to_list(a->cell[0]);
+  lval_del(a);
+  return list;
+}
+
+// maps only take numbers, strings and symbols as keys
+#define LASSERT_KEY(function, args, key) \
+  LASSERT(args, lmap_key_ok(key), \
+    "Function '%s' passed %s as a key, expected a number, string or symbol", \
+    function, lval_human_name((key)->type))
+
+// map-of {key value ...}, a new map, the keys and values are taken as they
+// are, like the items of any q-expression, #{key value ...} reads as this
+lval* builtin_map_of(lenv* e, lval* a) {
+  lval* list = a->cell[0];
+  LASSERT(a, list->count % 2 == 0,
+    "Function 'map-of' passed %i items, expected keys and values in pairs", list->count);
+  for (int i = 0; i < list->count; i += 2) {
+    LASSERT_KEY("map-of", a, list->cell[i]);
+  }
+
+  lval* m = lval_map();
+  for (int i = 0; i < list->count; i += 2) {
+    lmap_put(m->map, lval_copy(list->cell[i]), lval_copy(list->cell[i + 1]));
+  }
+  lval_del(a);
+  return m;
+}
+
+// map-get m key [default], the value kept for key, or default
+lval* builtin_map_get(lenv* e, lval* a) {
+  LASSERT_KEY("map-get", a, a->cell[1]);
+  lval* v = lmap_get(a->cell[0]->map, a->cell[1]);
+  if (!v) {
+    LASSERT(a, a->count == 3, "Function 'map-get' found no such key, and has no default");
+    v = lval_copy(a->cell[2]);
+  }
+  lval_del(a);
+  return v;
+}
+
+// map-put m key value, keeps value for key in m, and gives m back
+lval* builtin_map_put(lenv* e, lval* a) {
+  LASSERT_KEY("map-put", a, a->cell[1]);
+  lval* m = lval_copy(a->cell[0]);
+  lmap_put(m->map, lval_copy(a->cell[1]), lval_copy(a->cell[2]));
+  lval_del(a);
+  return m;
+}
+
+// map-del m key, drops whatever m keeps for key, and gives m back
+lval* builtin_map_del(lenv* e, lval* a) {
+  LASSERT_KEY("map-del", a, a->cell[1]);
+  lval* m = lval_copy(a->cell[0]);
+  lmap_del(m->map, a->cell[1]);
+  lval_del(a);
+  return m;
+}
+
+// map-keys m, its keys as a q-expression, in no particular order
+lval* builtin_map_keys(lenv* e, lval* a) {
+  lval* keys = lmap_keys(a->cell[0]->map);
+  lval_del(a);
+  return keys;
+}
+
+lval* builtin_map_size(lenv* e, lval* a) {
+  lval* n = lval_num(lmap_count(a->cell[0]->map));
+  lval_del(a);
+  return n;
 }
 
 lval* builtin_locals(lenv* env, lval* a) {
@@ -440,7 +965,7 @@ lval* builtin_locals(lenv* env, lval* a) {
 
   // create symbols and add them to a
   for(int i = 0; i < env->count; i++) {
-    if (lenv_get(env, lval_sym(env->syms[i]))->type != LVAL_FUN) {
+    if (!lval_callable(env->vals[i])) {
       a = lval_add(a, lval_sym(env->syms[i]));
     }
   }
@@ -449,7 +974,6 @@ lval* builtin_locals(lenv* env, lval* a) {
 }
 
 lval* builtin_type(lenv* env, lval* a) {
-  LASSERT_ARITY("type", a, 1);
   lval* str = lval_str(lval_human_name(a->cell[0]->type));
   lval_del(a);
 
@@ -461,7 +985,7 @@ lval* builtin_functions(lenv* env, lval* a) {
 
   // create symbols and add them to a
   for(int i = 0; i < env->count; i++) {
-    if (lenv_get(env, lval_sym(env->syms[i]))->type == LVAL_FUN) {
+    if (lval_callable(env->vals[i])) {
       a = lval_add(a, lval_sym(env->syms[i]));
     }
   }
@@ -470,9 +994,8 @@ lval* builtin_functions(lenv* env, lval* a) {
 }
 
 lval* builtin_lambda(lenv* env, lval* a) {
-  // there are two arguments
-  LASSERT_ARITY("lambda", a, 2);
-  // whose type are quoted expressions
+  a = lspecial_eval_all(env, a);
+  if (a->type == LVAL_ERR) { return a; }
   LASSERT_TYPE("lambda", a, 0, LVAL_QEXPR);
   LASSERT_TYPE("lambda", a, 1, LVAL_QEXPR);
 
@@ -493,18 +1016,21 @@ lval* builtin_lambda(lenv* env, lval* a) {
   // kill what was passed in
   lval_del(a);
 
-  return lval_lambda(formals, body);
+  // work out where each symbol in the body will be found once called
+  lval_resolve(body, formals, env);
+
+  lval* fn = lval_lambda(env, formals, body);
+
+  // and what can be worked out already
+  lvm_fold(fn);
+  return fn;
 }
 
 // returns 0 or 1 if symbol defined or not
 lval* builtin_exists(lenv* env, lval* a) {
-  // we can only process quoted expressions unfortunately atm
-  // because anything else will be evaluated
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-    "def passed an unquoted expression!");
-
   // grab the references (var names)
   lval* ref = a->cell[0];
+  LASSERT(a, ref->count != 0, "Function 'exists' passed {}!");
 
   // make sure they are indeed symbols
   LASSERT(a, ref->cell[0]->type == LVAL_SYM,
@@ -513,6 +1039,7 @@ lval* builtin_exists(lenv* env, lval* a) {
   lval* x = lenv_get(env, ref->cell[0]);
   int e = (x->type == LVAL_ERR) ? 0 : 1;
   lval_del(x);
+  lval_del(a);
 
   return lval_num(e);
 }
@@ -526,9 +1053,6 @@ lval* builtin_exit(lenv* env, lval* a) {
 
 // straight copying it
 lval* builtin_load(lenv* e, lval* a) {
-  LASSERT_ARITY("load", a, 1);
-  LASSERT_TYPE("load", a, 0, LVAL_STR);
-
   // create empty parsers
   mpc_parser_t* Number  = mpc_new("number");
   mpc_parser_t* Symbol  = mpc_new("symbol");
@@ -536,23 +1060,27 @@ lval* builtin_load(lenv* e, lval* a) {
   mpc_parser_t* Comment = mpc_new("comment");
   mpc_parser_t* Qexpr   = mpc_new("qexpr");
   mpc_parser_t* Sexpr   = mpc_new("sexpr");
+  mpc_parser_t* Vector  = mpc_new("vector");
+  mpc_parser_t* Map     = mpc_new("map");
   mpc_parser_t* Expr    = mpc_new("expr");
   mpc_parser_t* Lispy   = mpc_new("lispy");
 
   // fill the parsers with the lang
   mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                      \
-      number   : /-?[0-9]+/ ;                              \
-      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>|!&^\%]+/ ;    \
-      string   : /\"(\\\\.|[^\"])*\"/ ;                    \
-      comment  : /;[^\\r\\n]*/ ;                           \
-      qexpr    : '{' <expr>* '}' ;                         \
-      sexpr    : '(' <expr>* ')' ;                         \
-      expr     : <number> | <string> | <symbol> |          \
-                 <sexpr> | <qexpr> | <comment>;            \
-      lispy    : /^/ <expr>* /$/ ;                         \
+    "                                                       \
+      number   : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; \
+      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>|!&^\%]+/ ;     \
+      string   : /\"(\\\\.|[^\"])*\"/ ;                     \
+      comment  : /;[^\\r\\n]*/ ;                            \
+      qexpr    : '{' <expr>* '}' ;                          \
+      sexpr    : '(' <expr>* ')' ;                          \
+      vector   : '[' <number>* ']' ;                        \
+      map      : \"#{\" <expr>* '}' ;                       \
+      expr     : <number> | <string> | <symbol> | <sexpr> | \
+                 <qexpr> | <vector> | <map> | <comment> ;   \
+      lispy    : /^/ <expr>* /$/ ;                          \
     ",
-    Number, Symbol, String, Comment, Qexpr, Sexpr, Expr, Lispy);
+    Number, Symbol, String, Comment, Qexpr, Sexpr, Vector, Map, Expr, Lispy);
 
   mpc_result_t r;
 
@@ -572,11 +1100,15 @@ lval* builtin_load(lenv* e, lval* a) {
     /* Delete expressions and arguments */
     lval_del(expr);    
     lval_del(a);
+
+    // everything the file defined is known now, functions can count on
+    // constants defined after them
+    lvm_refold(e);
     
-    mpc_cleanup(8, Number, Symbol, String, Comment, Qexpr, Sexpr, Expr, Lispy);
+    mpc_cleanup(10, Number, Symbol, String, Comment, Qexpr, Sexpr, Vector, Map, Expr, Lispy);
 
     /* Return empty list */
-    return lval_sexpr();
+    return lval_nil();
     
   } else {
 
@@ -589,7 +1121,7 @@ lval* builtin_load(lenv* e, lval* a) {
     free(err_msg);
     lval_del(a);
 
-    mpc_cleanup(8, Number, Symbol, String, Comment, Qexpr, Sexpr, Expr, Lispy); 
+    mpc_cleanup(10, Number, Symbol, String, Comment, Qexpr, Sexpr, Vector, Map, Expr, Lispy); 
 
     /* Cleanup and return error */
     return err;
@@ -609,5 +1141,126 @@ lval* builtin_print(lenv* e, lval* a) {
   putchar('\n');
   lval_del(a);
 
-  return lval_sexpr();
-}
\ No newline at end of file
+  return lval_nil();
+}
+
+// allocation counters, so we can see what evaluating something costs
+lval* builtin_memstats(lenv* e, lval* a) {
+  lval_del(a);
+
+  lalloc_stats* stats = lalloc_stats_get();
+  lval* x = lval_qexpr();
+  x = lval_add(x, lval_sym("mallocs"));
+  x = lval_add(x, lval_num(stats->mallocs));
+  x = lval_add(x, lval_sym("frees"));
+  x = lval_add(x, lval_num(stats->frees));
+  x = lval_add(x, lval_sym("pooled"));
+  x = lval_add(x, lval_num(stats->pooled));
+  x = lval_add(x, lval_sym("released"));
+  x = lval_add(x, lval_num(stats->released));
+
+  return x;
+}
+
+lval* builtin_gc_stats(void) {
+  lgc_stats* stats = lgc_stats_get();
+  lval* x = lval_qexpr();
+  x = lval_add(x, lval_sym("collections"));
+  x = lval_add(x, lval_num(stats->collections));
+  x = lval_add(x, lval_sym("freed"));
+  x = lval_add(x, lval_num(stats->freed));
+  x = lval_add(x, lval_sym("live"));
+  x = lval_add(x, lval_num(stats->live));
+  x = lval_add(x, lval_sym("threshold"));
+  x = lval_add(x, lval_num(stats->threshold));
+
+  return x;
+}
+
+// collect now, and report on it
+lval* builtin_gc(lenv* e, lval* a) {
+  lval_del(a);
+  lgc_collect();
+
+  return builtin_gc_stats();
+}
+
+// gc-threshold n, sets how many allocations to wait between collections,
+// 0 turns automatic collection off
+lval* builtin_gc_threshold(lenv* e, lval* a) {
+  lgc_stats_get()->threshold = a->cell[0]->num;
+  lval_del(a);
+
+  return builtin_gc_stats();
+}
+
+// eval-mode "vm" or "tree", which evaluator to use from now on, the
+// tree walker is there to check the vm against
+lval* builtin_eval_mode(lenv* e, lval* a) {
+  char* mode = a->cell[0]->str;
+  LASSERT(a, strcmp(mode, "vm") == 0 || strcmp(mode, "tree") == 0,
+    "Function 'eval-mode' passed \"%s\", expected \"vm\" or \"tree\"", mode);
+
+  leval_mode = (strcmp(mode, "vm") == 0) ? LEVAL_VM : LEVAL_TREE;
+  lval_del(a);
+
+  return lval_nil();
+}
+
+// memo f, or memo f n, f keeping its results, the last n it was called
+// with, so calling it with the same arguments again doesn't repeat the work
+lval* builtin_memo(lenv* e, lval* a) {
+  lval* fn = a->cell[0];
+  LASSERT(a, (fn->type == LVAL_FUN && !fn->builtin) || fn->type == LVAL_PARTIAL,
+    "Function 'memo' passed a %s, expected a user defined function",
+    lval_human_name(fn->type));
+
+  int capacity = LMEMO_CAPACITY;
+  if (a->count == 2) {
+    LASSERT(a, a->cell[1]->num > 0,
+      "Function 'memo' passed %li, expected 1 or more results to keep", a->cell[1]->num);
+    capacity = a->cell[1]->num;
+  }
+
+  lval* memo = lval_memo(fn, capacity);
+  lval_del(a);
+  return memo;
+}
+
+// simd-mode "auto", "avx2", "sse2" or "scalar", which kernels vectors
+// are worked on with, gives the name of those picked for "auto"
+lval* builtin_simd_mode(lenv* e, lval* a) {
+  char* mode = a->cell[0]->str;
+  LASSERT(a, lvec_use(mode),
+    "Function 'simd-mode' passed \"%s\", expected \"auto\", or one of "
+    "\"avx2\", \"sse2\" or \"scalar\" this cpu can run", mode);
+
+  lval_del(a);
+  return lval_str(lvec_kernels_name());
+}
+
+// jit-mode "on" or "off", whether hot functions are compiled to native
+// code, so their results can be checked against the vm's
+lval* builtin_jit_mode(lenv* e, lval* a) {
+  char* mode = a->cell[0]->str;
+  LASSERT(a, strcmp(mode, "on") == 0 || strcmp(mode, "off") == 0,
+    "Function 'jit-mode' passed \"%s\", expected \"on\" or \"off\"", mode);
+
+  ljit_enabled = strcmp(mode, "on") == 0;
+  lval_del(a);
+
+  return lval_nil();
+}
+
+// max-depth n, how many calls deep evaluation may go before giving up
+// with an error, 0 for as deep as memory allows, the vm keeps its frames
+// on the heap but the tree walker recurses, and needs the C stack for it
+lval* builtin_max_depth(lenv* e, lval* a) {
+  LASSERT(a, a->cell[0]->num >= 0,
+    "Function 'max-depth' passed %li, expected 0 or more", a->cell[0]->num);
+
+  leval_max_depth = a->cell[0]->num;
+  lval_del(a);
+
+  return lval_nil();
+}
@@ -1,3 +1,15 @@
+// calling builtins, checking what they're passed first
+lval* lbuiltin_call(lenv* env, lval* fn, lval* a);
+int   lnum_arith(int op, long x, long y, long* out);
+int   lnum_compare(int op, long x, long y);
+int   lnum_arith_dbl(int op, double x, double y, double* out);
+int   lnum_div_zero(int op, double x, double y);
+lval* lnum_dbl_err(int op, double x, double y);
+int   lnum_compare_dbl(int op, double x, double y);
+double lnum_dbl(lval* v);
+int   lnum_any_dbl(lval** args, int n);
+lval* lnum_dbl_into(lval** args, int n, double d);
+
 lval* builtin_quote(lenv* env, lval* a);
 lval* builtin_error(lenv* e, lval* a);
 
@@ -9,6 +21,8 @@ lval* builtin_eval(lenv* env, lval* a);
 lval* builtin_min(lenv* env, lval* a);
 lval* builtin_max(lenv* env, lval* a);
 lval* builtin_nth(lenv* env, lval* a);
+lval* builtin_take(lenv* env, lval* a);
+lval* builtin_slice(lenv* env, lval* a);
 lval* builtin_length(lenv* env, lval* a);
 
 lval* builtin_locals(lenv* env, lval* a);
@@ -19,7 +33,7 @@ lval* builtin_exit(lenv* env, lval* a);
 lval* builtin_exists(lenv* env, lval* a);
 
 // comparisons
-lval* builtin_compare(lenv* env, lval* a, char *op);
+lval* builtin_compare(lenv* env, lval* a, int op);
 lval* builtin_gt(lenv* env, lval* a);
 lval* builtin_lt(lenv* env, lval* a);
 lval* builtin_gte(lenv* env, lval* a);
@@ -32,6 +46,8 @@ lval* builtin_if(lenv* env, lval* a);
 lval* builtin_and(lenv* env, lval* a);
 lval* builtin_or(lenv* env, lval* a);
 lval* builtin_not(lenv* env, lval* a);
+lval* builtin_do(lenv* env, lval* a);
+lval* builtin_let(lenv* env, lval* a);
 
 // defining a symbols
 lval* builtin_def(lenv* e, lval* a);
@@ -49,10 +65,41 @@ lval* builtin_mul(lenv* e, lval* a);
 lval* builtin_div(lenv* e, lval* a);
 lval* builtin_mod(lenv* e, lval* a);
 lval* builtin_exp(lenv* e, lval* a);
+lval* builtin_sqrt(lenv* e, lval* a);
+lval* builtin_log(lenv* e, lval* a);
+lval* builtin_exp_e(lenv* e, lval* a);
+lval* builtin_floor(lenv* e, lval* a);
+
+// vectors
+lval* builtin_vec(lenv* e, lval* a);
+lval* builtin_vec_range(lenv* e, lval* a);
+lval* builtin_vec_list(lenv* e, lval* a);
+lval* builtin_simd_mode(lenv* e, lval* a);
+
+// maps
+lval* builtin_map_of(lenv* e, lval* a);
+lval* builtin_map_get(lenv* e, lval* a);
+lval* builtin_map_put(lenv* e, lval* a);
+lval* builtin_map_del(lenv* e, lval* a);
+lval* builtin_map_keys(lenv* e, lval* a);
+lval* builtin_map_size(lenv* e, lval* a);
 //___triggers math
-lval* builtin_op(lenv* e, lval* a, char* op);
+lval* builtin_op(lenv* e, lval* a, int op);
 
 // file io
 lval* builtin_load(lenv* e, lval* a);
 
-lval* builtin_print(lenv* e, lval* a);
\ No newline at end of file
+lval* builtin_print(lenv* e, lval* a);
+
+// introspection
+lval* builtin_memstats(lenv* e, lval* a);
+lval* builtin_gc_stats(void);
+lval* builtin_gc(lenv* e, lval* a);
+lval* builtin_gc_threshold(lenv* e, lval* a);
+lval* builtin_eval_mode(lenv* e, lval* a);
+lval* builtin_max_depth(lenv* e, lval* a);
+lval* builtin_jit_mode(lenv* e, lval* a);
+lval* builtin_memo(lenv* e, lval* a);
+lval* builtin_delay(lenv* e, lval* a);
+lval* builtin_force(lenv* e, lval* a);
+lval* builtin_lazy_cons(lenv* e, lval* a);
\ No newline at end of file
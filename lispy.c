@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <editline/readline.h>
 
 #include "mpc.h"
@@ -9,9 +10,16 @@
 lval* lval_read_num(mpc_ast_t* tree) {
   errno = 0;
 
+  // with a point or an exponent it's a float
+  if (strpbrk(tree->contents, ".eE")) {
+    double x = strtod(tree->contents, NULL);
+    // too small comes out as near enough zero, too big can't be had
+    return errno != ERANGE || fabs(x) < 1 ? lval_dbl(x) : lval_err("invalid number");
+  }
+
   // strtol takes pointer, a reference to its terminal null character (duh), and the base as a basis of interpretation of the string
   long x = strtol(tree->contents, NULL, 10);
-  return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+  return errno != ERANGE ? lval_num(x) : lbig_read(tree->contents);
 }
 
 lval* lval_read_str(mpc_ast_t* tree) {
@@ -48,12 +56,27 @@ lval* lval_read(mpc_ast_t* tree) {
   // this is already tagged as an sexpr
   if (strstr(tree->tag, "sexpr")) { x = lval_sexpr(); }
 
+  // read as a list of its numbers, which are then packed together
+  int vector = strstr(tree->tag, "vector") != NULL;
+  if (vector) { x = lval_qexpr(); }
+
+  // #{key value ...} reads as (map-of {key value ...}), so a map written
+  // in code is a new one each time it's evaluated, not one shared by all
+  int map = strstr(tree->tag, "map") != NULL;
+  if (map) { x = lval_qexpr(); }
+
+  // one cell per child at most, grow once rather than per cell
+  if (x) { lval_reserve(x, tree->children_num); }
+
   for (int i = 0; i < tree->children_num; i++) {
     // skip grammar
     if (strcmp(tree->children[i]->contents, "(") == 0) { continue; }
     if (strcmp(tree->children[i]->contents, ")") == 0) { continue; }
     if (strcmp(tree->children[i]->contents, "{") == 0) { continue; }
     if (strcmp(tree->children[i]->contents, "}") == 0) { continue; }
+    if (strcmp(tree->children[i]->contents, "[") == 0) { continue; }
+    if (strcmp(tree->children[i]->contents, "]") == 0) { continue; }
+    if (strcmp(tree->children[i]->contents, "#{") == 0) { continue; }
     if (strcmp(tree->children[i]->tag,  "regex") == 0) { continue; }
     if (strstr(tree->children[i]->tag, "comment")) { continue; }
 
@@ -61,7 +84,8 @@ lval* lval_read(mpc_ast_t* tree) {
     x = lval_add(x, lval_read(tree->children[i]));
   }
 
-  return x;
+  if (map) { return lval_add(lval_add(lval_sexpr(), lval_sym("map-of")), x); }
+  return vector ? lvec_of_list(x) : x;
 }
 
 int main(int argc, char** argv) {
@@ -70,6 +94,9 @@ int main(int argc, char** argv) {
   puts("Lispy Version 0.0.0.0.1");
   puts("Press Ctrl+c to Exit\n");
 
+  // symbols are interned from here on
+  lsym_init();
+
   // create empty parsers
   mpc_parser_t* Number  = mpc_new("number");
   mpc_parser_t* Symbol  = mpc_new("symbol");
@@ -77,23 +104,27 @@ int main(int argc, char** argv) {
   mpc_parser_t* Comment = mpc_new("comment");
   mpc_parser_t* Qexpr   = mpc_new("qexpr");
   mpc_parser_t* Sexpr   = mpc_new("sexpr");
+  mpc_parser_t* Vector  = mpc_new("vector");
+  mpc_parser_t* Map     = mpc_new("map");
   mpc_parser_t* Expr    = mpc_new("expr");
   mpc_parser_t* Lispy   = mpc_new("lispy");
 
   // fill the parsers with the lang
   mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                      \
-      number   : /-?[0-9]+/ ;                              \
-      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>|!&^\%]+/ ;    \
-      string   : /\"(\\\\.|[^\"])*\"/ ;                    \
-      comment  : /;[^\\r\\n]*/ ;                           \
-      qexpr    : '{' <expr>* '}' ;                         \
-      sexpr    : '(' <expr>* ')' ;                         \
-      expr     : <number> | <string> | <symbol> |          \
-                 <sexpr> | <qexpr> | <comment>;            \
-      lispy    : /^/ <expr>* /$/ ;                         \
+    "                                                       \
+      number   : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; \
+      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>|!&^\%]+/ ;     \
+      string   : /\"(\\\\.|[^\"])*\"/ ;                     \
+      comment  : /;[^\\r\\n]*/ ;                            \
+      qexpr    : '{' <expr>* '}' ;                          \
+      sexpr    : '(' <expr>* ')' ;                          \
+      vector   : '[' <number>* ']' ;                        \
+      map      : \"#{\" <expr>* '}' ;                       \
+      expr     : <number> | <string> | <symbol> | <sexpr> | \
+                 <qexpr> | <vector> | <map> | <comment> ;   \
+      lispy    : /^/ <expr>* /$/ ;                          \
     ",
-    Number, Symbol, String, Comment, Qexpr, Sexpr, Expr, Lispy);
+    Number, Symbol, String, Comment, Qexpr, Sexpr, Vector, Map, Expr, Lispy);
 
   // create environment and add functions
   lenv* env = lenv_new();
@@ -163,7 +194,7 @@ int main(int argc, char** argv) {
   lenv_del(env);
 
   /* Undefine and Delete our Parsers */
-  mpc_cleanup(8, Number, Symbol, String, Comment, Qexpr, Sexpr, Expr, Lispy);
+  mpc_cleanup(10, Number, Symbol, String, Comment, Qexpr, Sexpr, Vector, Map, Expr, Lispy);
 
   return 0;
 }
@@ -11,56 +11,211 @@ struct lval;
 struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lmemo lmemo;
+typedef struct lmap lmap;
 
-enum { LVAL_NUM, LVAL_BOOL, LVAL_ERR, LVAL_SYM, LVAL_STR,
-       LVAL_FUN, LVAL_SIG, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_NUM, LVAL_BIG, LVAL_DBL, LVAL_BOOL, LVAL_ERR, LVAL_SYM, LVAL_STR,
+       LVAL_FUN, LVAL_PARTIAL, LVAL_MEMO, LVAL_SIG, LVAL_SEXPR, LVAL_QEXPR,
+       LVAL_LAZY, LVAL_SEQ, LVAL_VEC, LVAL_MAP };
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+// what each builtin is, so whatever calls it can tell without comparing
+// functions or names, LB_NONE for all those with no fast path of their own
+enum { LB_NONE,
+       LB_ADD, LB_SUB, LB_MUL, LB_DIV, LB_MOD, LB_POW,
+       LB_GT, LB_LT, LB_GTE, LB_LTE, LB_EQ, LB_NEQ,
+       LB_MIN, LB_MAX, LB_HEAD, LB_TAIL,
+       LB_IF, LB_AND, LB_OR, LB_DO };
+
+// a builtin and what it takes, see the table in env.c, the arguments are
+// checked against it before the builtin is called, see lbuiltin_call
+typedef struct lbuiltin_info {
+  char* name;
+  lbuiltin fn;
+  int op;
+  // how many arguments, max is -1 when there's no limit
+  int min;
+  int max;
+  // the type of each argument in turn, the last repeated for the rest,
+  // 'n' number, 'r' number or float, 'v' number, float or vector,
+  // 's' string, 'm' map, 'q' quoted expression, 'l' quoted expression,
+  // lazy sequence or vector, '*' anything, NULL for no checks at all
+  char* types;
+  int flags;
+} lbuiltin_info;
+
+// the builtin only works out its value from its arguments, so given
+// constants it can be called ahead of time, see vm.c
+#define LB_PURE 1
+// the builtin is a special form, which is handed its operands as they
+// were written, unevaluated, and evaluates whichever it needs itself,
+// with lval_eval, it's only given them to read, see lval_special
+#define LB_SPECIAL 2
+
 struct lval {
   // one of the enums, duh
   int type;
 
-  // numbers
-  long num;
+  // reference count, values are shared rather than copied so anything
+  // which wants to modify one in place has to lval_own it first
+  int refs;
 
-  // boolean type, 0 or 1
-  int boolean;
+  // only the fields belonging to the type are ever live, so they share
+  // the same few bytes
+  union {
+    // numbers
+    long num;
 
-  // signals, should be 0-9
-  int sig;
+    // integers too big for num, see bignum.c, the magnitude in base 2^32
+    // limbs, least significant first, never small enough to be a number
+    struct {
+      unsigned int* limbs;
+      int limbs_count;
+      int negative;
+    };
 
-  // error messages
-  char *err;
+    // floats, held in place like numbers
+    double dbl;
 
-  // symbol references
-  char *sym;
+    // boolean type, 0 or 1
+    int boolean;
 
-  // strings
-  char *str;
+    // signals, should be 0-9
+    int sig;
 
-  // builtin functions
-  lbuiltin builtin;
+    // error messages
+    char *err;
 
-  // user defined functions
-  lenv* env;
-  lval* formals;
-  lval* body;
+    // symbol references, always interned, see lsym_intern
+    struct {
+      char *sym;
 
-  // count is the list length of a s or q expression
-  int count;
+      // where the symbol is expected to be bound, filled in by lval_resolve,
+      // 'depth' frames up from where it is evaluated at position 'slot'
+      int depth;
+      int slot;
+    };
+
+    // strings
+    char *str;
+
+    // functions, builtin ones only use 'builtin' and 'info', user defined
+    // ones leave it NULL and use the rest
+    struct {
+      lbuiltin builtin;
+      union {
+        lbuiltin_info* info;
+        // the environment the function was created in, calls are evaluated
+        // in a new frame below it
+        lenv* env;
+      };
+      lval* formals;
+      lval* body;
+    };
+
+    // a user defined function given fewer arguments than it takes, which
+    // are kept to be bound along with the rest, see lval_bind
+    struct {
+      lval* applied;
+      lval* bound;
+    };
+
+    // a function which keeps its results, see memo.c
+    lmemo* memo;
+
+    // a promise, the expression to evaluate in 'scope', or once it has
+    // been forced, its value, with scope NULL, see lazy.c
+    struct {
+      lval* promised;
+      lenv* scope;
+    };
+
+    // a vector, see vec.c, vec_count integers or floats in a row
+    struct {
+      union {
+        long* vec_ints;
+        double* vec_dbls;
+      };
+      long vec_count;
+      int vec_float;
+      // set when this is a read-only window onto the elements of another
+      // vector, which it keeps a reference to, see lvec_slice
+      struct lval* vec_backing;
+    };
 
-  // cell points to other lval pointers
-  struct lval** cell;
+    // a hash map, changed in place, see map.c
+    lmap* map;
+
+    // a lazy sequence, its first item and a promise of the rest
+    struct {
+      lval* first;
+      lval* rest;
+    };
+
+    // s and q expressions
+    struct {
+      // count is the list length of a s or q expression
+      int count;
+
+      // slots allocated, counted from the start of the allocation
+      int cap;
+
+      // how far cell has moved past the start of the allocation, popping
+      // the head of a list just moves cell along
+      int off;
+
+      // the list compiled to bytecode, once it has been run by the vm,
+      // an index into its table of code rather than a pointer so lvals
+      // don't grow, 0 when there is none, see vm.c
+      int code;
+
+      // cell points to other lval pointers
+      struct lval** cell;
+
+      // set when this list is a read-only window onto the cells of
+      // another, which it keeps a reference to, see lval_slice
+      struct lval* backing;
+    };
+  };
 };
 
+// refs of values which live forever and are never freed, such as
+// true, false, () and the small numbers
+#define LVAL_IMMORTAL -1
+
+// symbol depths which aren't a number of frames, see lval_resolve
+#define LSYM_UNRESOLVED -1
+#define LSYM_GLOBAL -2
+
+// numbers in this range are preallocated and shared
+#define LVAL_NUM_CACHE_MIN -128
+#define LVAL_NUM_CACHE_MAX 1023
+
 struct lenv {
+  // reference count, environments are shared by the functions created in
+  // them and by the environments below them
+  int refs;
+  // holds a reference
   lenv* parent;
   int count;
+  // room in syms and vals
+  int cap;
+  // interned, so compared by pointer
   char** syms;
   lval** vals;
+  // once an env holds more than a handful of symbols, an open addressing
+  // table of their positions in syms/vals, -1 marks an empty slot
+  int* index;
+  int index_cap;
+  // set when syms and vals are one block of LENV_SLOTS each from the
+  // pool, see lenv_frame
+  int pooled;
 };
 
+// frames for calls with up to this many arguments come from a pool
+#define LENV_SLOTS 8
+
 #define LASSERT(args, condition, message, ...) \
   if (!(condition)) { \
     lval *err = lval_err(message, ##__VA_ARGS__); \
@@ -85,6 +240,94 @@ struct lenv {
     arguments->count, \
     expected);
 
+// allocation counters, see alloc.c
+typedef struct lalloc_stats {
+  // calls into the system allocator
+  long mallocs;
+  long frees;
+  // objects handed out from and returned to the pools
+  long pooled;
+  long released;
+} lalloc_stats;
+
+// collector settings and counters, see gc.c
+typedef struct lgc_stats {
+  long collections;
+  // objects freed by the collector, all told
+  long freed;
+  // lvals and lenvs left after the last collection
+  long live;
+  // allocations between collections, at least, 0 turns collection off
+  long threshold;
+} lgc_stats;
+
+#define LGC_THRESHOLD 100000
+
+// memory
+lval* lval_alloc(void);
+void  lval_free(lval* v);
+lenv* lenv_alloc(void);
+void  lenv_free(lenv* e);
+void* lslots_alloc(void);
+void  lslots_free(void* slots);
+char* lstr_dup(char* s);
+void  lstr_free(char* s);
+void* lmem_alloc(size_t size);
+void* lmem_realloc(void* p, size_t size);
+void  lmem_free(void* p);
+lalloc_stats* lalloc_stats_get(void);
+long  lalloc_since_gc(void);
+void  lalloc_each(int envs, void (*fn)(void*));
+void  lalloc_gc_begin(void);
+void  lalloc_gc_end(void);
+int*  lalloc_gc_count(void* obj);
+
+// garbage collection
+void  lgc_collect(void);
+void  lgc_maybe_collect(void);
+lgc_stats* lgc_stats_get(void);
+
+// symbol interning
+char* lsym_intern(char* name);
+int*  lsym_flags(char* sym);
+void  lsym_varies(char* sym);
+void  lval_resolve(lval* body, lval* formals, lenv* env);
+void  lsym_init(void);
+
+// what's known about a global, see lsym_flags
+// some code has had its value folded into it, see vm.c
+#define LSYM_FOLDED 1
+// it has been redefined, or bound other than globally, so never is
+#define LSYM_VARIES 2
+// it has been bound other than globally, as an argument or with '='
+#define LSYM_LOCAL 4
+// it has been added to a frame with '=', which may be nearer than where
+// a closure's body was resolved to find it, see lenv_get
+#define LSYM_SHADOWS 8
+
+// interned names we look for from C
+extern char* lsym_rest;
+extern char* lsym_def;
+extern char* lsym_put;
+extern char* lsym_add;
+extern char* lsym_sub;
+extern char* lsym_mul;
+extern char* lsym_div;
+extern char* lsym_mod;
+extern char* lsym_pow;
+extern char* lsym_gt;
+extern char* lsym_lt;
+extern char* lsym_gte;
+extern char* lsym_lte;
+extern char* lsym_eq;
+extern char* lsym_neq;
+extern char* lsym_if;
+extern char* lsym_and;
+extern char* lsym_or;
+extern char* lsym_do;
+extern char* lsym_head;
+extern char* lsym_tail;
+
 // parsing hooks
 lval* lval_read_num(mpc_ast_t* tree);
 lval* lval_read_str(mpc_ast_t* tree);
@@ -92,16 +335,27 @@ lval* lval_read(mpc_ast_t* tree);
 
 // lisp-value generic instance operations
 void  lval_del(lval* v);
+void  lval_bury(lval* v, lenv* e);
 lval* lval_add(lval* list, lval* incoming);
 lval* lval_join(lval* x, lval* y);
+lval* lval_splice(lval* x, int index, lval* y);
+lval* lval_slice(lval* list, int start, int count);
+lval* lval_head(lval* list);
+lval* lval_tail(lval* list);
+void  lval_reserve(lval* list, int n);
 lval* lval_pop(lval* expression, int index);
 lval* lval_unshift(lval* list, lval* incoming);
 lval* lval_take(lval* val, int index);
 lval* lval_copy(lval* org);
+lval* lval_own(lval* v);
 int lval_true(lval* val);
 
 // instance types
 lval* lval_num(long x);
+lval* lval_big(unsigned int* limbs, int count, int negative);
+lval* lval_dbl(double x);
+lval* lval_vec(int floats, long count);
+lval* lval_map(void);
 lval* lval_bool(int x);
 lval* lval_sig(int x);
 lval* lval_err(char* message, ...);
@@ -109,23 +363,126 @@ lval* lval_sym(char* s);
 lval* lval_str(char* s);
 lval* lval_qexpr(void);
 lval* lval_sexpr(void);
-lval* lval_fun(lbuiltin fn);
-lval* lval_lambda(lval* formals, lval* body);
+lval* lval_nil(void);
+lval* lval_fun(lbuiltin_info* info);
+lval* lval_lambda(lenv* env, lval* formals, lval* body);
+lval* lval_partial(lval* fn, lval* bound);
+lval* lval_memo(lval* fn, int capacity);
+lval* lval_lazy(lenv* env, lval* expr);
+lval* lval_seq(lval* first, lval* rest);
 
 // environment instance operations
 lenv* lenv_new(void);
+lenv* lenv_frame(lenv* parent, lval* formals, lval** vals);
+void  lenv_free_storage(lenv* env);
 lval* lenv_get(lenv* env, lval* key);
+extern unsigned long lenv_version;
+int   lenv_find(lenv* env, char* sym);
 void  lenv_put(lenv* env, lval* key, lval* value);
 void  lenv_def(lenv* env, lval* key, lval* value);
 void  lenv_del(lenv* env);
 lenv* lenv_copy(lenv* org);
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin builtin);
+void lenv_add_builtin(lenv* e, lbuiltin_info* info);
 void lenv_add_builtins(lenv* e) ;
 
 // lisp read and evaluation
 lval* lval_eval(lenv* env, lval* val);
 lval* lval_eval_sexpr(lenv* env, lval* expr);
+lval* lval_bind(lval* fn, lval* args, lenv** frame);
+lval* lval_applied(lval** fn, lval* args);
+int   lval_callable(lval* v);
+int   lval_special(lval* v);
+unsigned long lval_hash(lval* v);
+int   lval_equal(lval* x, lval* y);
+
+// memoised functions
+lmemo* lmemo_new(lval* fn, int capacity);
+lval* lmemo_fn(lmemo* m);
+int   lmemo_capacity(lmemo* m);
+lval* lmemo_get(lmemo* m, lval* args);
+void  lmemo_put(lmemo* m, lval* args, lval* value);
+void  lmemo_each(lmemo* m, void (*fn)(lval*));
+void  lmemo_free(lmemo* m);
+
+// results memo keeps unless it's told otherwise
+#define LMEMO_CAPACITY 4096
+
+// big numbers
+lval* lbig_arith(int op, lval* x, lval* y);
+lval* lbig_neg(lval* x);
+int   lbig_compare(int op, lval* x, lval* y);
+double lbig_dbl(lval* v);
+lval* lbig_of_dbl(double x);
+lval* lbig_read(char* s);
+char* lbig_str(lval* v);
+
+// vectors
+int   lvec_any(lval** args, int n);
+lval* lvec_op(lval* a, int op);
+lval* lvec_compare(lval* a, int op);
+lval* lvec_of_list(lval* list);
+lval* lvec_to_list(lval* v);
+lval* lvec_nth(lval* v, long i);
+lval* lvec_slice(lval* v, long start, long count);
+lval* lvec_range(long n);
+int   lvec_use(char* name);
+char* lvec_kernels_name(void);
+
+// maps
+lmap* lmap_new(void);
+lmap* lmap_copy(lmap* org);
+int   lmap_count(lmap* m);
+int   lmap_key_ok(lval* k);
+lval* lmap_get(lmap* m, lval* key);
+void  lmap_put(lmap* m, lval* key, lval* value);
+int   lmap_del(lmap* m, lval* key);
+lval* lmap_keys(lmap* m);
+int   lmap_next(lmap* m, int i, lval** key, lval** value);
+void  lmap_each(lmap* m, void (*fn)(lval*));
+void  lmap_free(lmap* m);
+
+// promises and lazy sequences
+lval* lval_force(lval* v);
+lval* lval_seq_rest(lval* seq);
+lval* lval_seq_drop(lval* list, long n, long* dropped);
+lval* lval_seq_take(lval* list, long n);
+lval* lval_defer(lval* x);
+lval* lval_defer_in(lenv* env, lval* x);
+lval* lval_deferred(lval* result, lenv** env);
+
+// which of the evaluators lval_eval hands s-expressions to, the tree
+// walker in lvals.c is kept to check the vm against
+enum { LEVAL_TREE, LEVAL_VM };
+extern int leval_mode;
+
+// the default cap on how many calls deep evaluation may go, the tree
+// walker never goes deeper than its own limit, as it recurses in C
+#define LEVAL_MAX_DEPTH 100000
+#define LEVAL_TREE_MAX_DEPTH 20000
+extern int leval_max_depth;
+lval* lval_too_deep(void);
+
+// bytecode, see vm.c
+lval* lvm_eval(lenv* env, lval* expr);
+void  lvm_release(int code);
+void  lvm_fold(lval* fn);
+void  lvm_refold(lenv* env);
+void  lvm_deopt(void);
+
+// native code for hot functions, see jit.c
+typedef struct ljit ljit;
+ljit* ljit_compile(lval* fn);
+int   ljit_valid(ljit* j);
+int   ljit_fits(ljit* j, lval* fn);
+lval* ljit_call(ljit* j, lval* args, int depth, int* too_deep);
+void  ljit_free(ljit* j);
+extern int ljit_enabled;
+
+// calls to a user function before it's compiled
+#define LJIT_THRESHOLD 50
+// how deep compiled code may call itself before leaving it to the vm
+#define LJIT_MAX_DEPTH 10000
 
 // print utilities
 void lval_print(lval* v);
@@ -13,21 +13,47 @@
 //
 //
 
+// makes sure there is room for n more cells at the end of list,
+// growing geometrically so building a list is amortized O(1) per cell
+void lval_reserve(lval* list, int n) {
+  if (list->off + list->count + n <= list->cap) { return; }
+
+  lval** base = list->cell ? list->cell - list->off : NULL;
+
+  // slide everything back to the start of the allocation first
+  if (list->off) {
+    memmove(base, list->cell, sizeof(lval*) * list->count);
+    list->off = 0;
+    list->cell = base;
+  }
+
+  if (list->count + n > list->cap) {
+    int cap = list->cap ? list->cap * 2 : 4;
+    while (cap < list->count + n) { cap *= 2; }
+
+    list->cell = lmem_realloc(base, sizeof(lval*) * cap);
+    list->cap = cap;
+  }
+}
+
 lval* lval_pop(lval* expression, int index) {
   // store our target pointer value
   lval* value = expression->cell[index];
 
-  // move the move memory over one
-  // arguments are pointer to the destination, the data being copied, the number of bytes to copy
-  memmove(&expression->cell[index], &expression->cell[index + 1],
-    sizeof(lval*) * (expression->count - index - 1));
+  if (index == 0) {
+    // popping the head just steps over it
+    expression->cell++;
+    expression->off++;
+  } else {
+    // move the move memory over one
+    // arguments are pointer to the destination, the data being copied, the number of bytes to copy
+    memmove(&expression->cell[index], &expression->cell[index + 1],
+      sizeof(lval*) * (expression->count - index - 1));
+  }
 
   // decrement the count
   expression->count--;
 
-  // reallocate memory (drop the space for the final pointer)
-  expression->cell = realloc(expression->cell, sizeof(lval*) * expression->count);
-
   return value;
 }
 
@@ -40,83 +66,296 @@ lval* lval_take(lval* val, int index) {
   return target;
 }
 
-void lval_del(lval* v) {
+// values and environments nothing refers to any more, which still have
+// to be taken apart, lenvs are tagged in the low bit
+// freeing one thing can leave others with nothing referring to them, they
+// go on here rather than being freed there and then, so a deeply nested
+// list or a long chain of environments is freed in a loop and not by
+// recursing once per level
+static void** dead = NULL;
+static int dead_count = 0;
+static int dead_cap = 0;
+
+static void lval_dead(void* obj) {
+  if (dead_count == dead_cap) {
+    dead_cap = dead_cap ? dead_cap * 2 : 64;
+    dead = lmem_realloc(dead, sizeof(void*) * dead_cap);
+  }
+  dead[dead_count++] = obj;
+}
+
+// drops a reference held by something being taken apart
+static void lval_drop(lval* v) {
+  if (v->refs != LVAL_IMMORTAL && --v->refs == 0) { lval_dead(v); }
+}
+
+static void lenv_drop(lenv* e) {
+  if (--e->refs == 0) { lval_dead((char*)e + 1); }
+}
+
+static void lval_take_apart(lval* v) {
   switch (v->type) {
     case LVAL_FUN:
       // no extra work is required to delete built-in functions
       // but user space functions get nuked
       if (!v->builtin) {
-        lenv_del(v->env);
-        lval_del(v->formals);
-        lval_del(v->body);
+        lenv_drop(v->env);
+        lval_drop(v->formals);
+        lval_drop(v->body);
         break;
       }
     case LVAL_NUM: break;
+    case LVAL_DBL: break;
+
+    case LVAL_PARTIAL:
+      lval_drop(v->applied);
+      lval_drop(v->bound);
+      break;
+
+    case LVAL_MEMO:
+      lmemo_each(v->memo, lval_drop);
+      lmemo_free(v->memo);
+      break;
+
+    case LVAL_MAP:
+      lmap_each(v->map, lval_drop);
+      lmap_free(v->map);
+      break;
+
+    case LVAL_LAZY:
+      lval_drop(v->promised);
+      if (v->scope) { lenv_drop(v->scope); }
+      break;
+
+    case LVAL_SEQ:
+      lval_drop(v->first);
+      lval_drop(v->rest);
+      break;
 
     // we have to free the error message / symbol / string
-    case LVAL_ERR: free(v->err); break;
-    case LVAL_SYM: free(v->sym); break;
-    case LVAL_STR: free(v->str); break;
+    case LVAL_ERR: lstr_free(v->err); break;
+    case LVAL_STR: lstr_free(v->str); break;
+    case LVAL_BIG: lmem_free(v->limbs); break;
+    // windows don't own their elements, just the vector they look into
+    case LVAL_VEC:
+      if (v->vec_backing) {
+        lval_drop(v->vec_backing);
+      } else {
+        lmem_free(v->vec_ints);
+      }
+      break;
 
     // release the cells
     case LVAL_QEXPR:
     case LVAL_SEXPR:
+      if (v->code) { lvm_release(v->code); }
+
+      // windows don't own their cells, just the list they look into
+      if (v->backing) {
+        lval_drop(v->backing);
+        break;
+      }
+
       for (int i = 0; i < v->count; i++) {
-        lval_del(v->cell[i]);
+        lval_drop(v->cell[i]);
       }
-      // free the pointers
-      free(v->cell);
+      // free the pointers, from where the allocation really started
+      if (v->cell) { lmem_free(v->cell - v->off); }
       break;
   }
 
-  free(v);
+  lval_free(v);
+}
+
+static void lenv_take_apart(lenv* e) {
+  // free the lvals the syms refer to, the syms themselves are interned
+  for (int i = 0; i < e->count; i++) {
+    lval_drop(e->vals[i]);
+  }
+
+  // free pointers to the start of the reference array and values array
+  lenv_free_storage(e);
+
+  if (e->parent) { lenv_drop(e->parent); }
+
+  // free pointer to the environment
+  lenv_free(e);
+}
+
+// frees v or e, which nothing refers to any more, along with everything
+// left with nothing referring to it as a result
+void lval_bury(lval* v, lenv* e) {
+  // already taking things apart further up, it'll get to these
+  int outermost = dead_count == 0;
+
+  if (v) { lval_dead(v); }
+  if (e) { lval_dead((char*)e + 1); }
+  if (!outermost) { return; }
+
+  while (dead_count) {
+    char* next = dead[--dead_count];
+    if ((unsigned long)next & 1) {
+      lenv_take_apart((lenv*)(next - 1));
+    } else {
+      lval_take_apart((lval*)next);
+    }
+  }
+}
+
+// drops a reference, the value is only really freed once nobody holds it
+void lval_del(lval* v) {
+  if (v->refs == LVAL_IMMORTAL || --v->refs > 0) { return; }
+  lval_bury(v, NULL);
 }
 
 // in-place modifies list
 lval* lval_add(lval* list, lval* incoming) {
-  list->count++;
-  list->cell = realloc(list->cell, sizeof(lval*) * list->count);
-  list->cell[list->count - 1] = incoming;
+  list = lval_own(list);
+  lval_reserve(list, 1);
+  list->cell[list->count++] = incoming;
 
   return list;
 }
 
 // in-place modifies list
 lval* lval_unshift(lval* list, lval* incoming) {
+  list = lval_own(list);
+
+  // reuse the space left behind by popping the head if there is any
+  if (list->off > 0) {
+    list->cell--;
+    list->off--;
+    list->count++;
+    list->cell[0] = incoming;
+    return list;
+  }
+
   // make it bigger
-  list->count++;
-  list->cell = realloc(list->cell, sizeof(lval*) * list->count);
+  lval_reserve(list, 1);
 
   // shift existing memory
   // arguments are pointer to the destination, the data being copied, the number of bytes to copy
   memmove(&list->cell[1], &list->cell[0],
-    sizeof(lval*) * (list->count - 1));
+    sizeof(lval*) * list->count);
 
+  list->count++;
   list->cell[0] = incoming;
 
   return list;
 }
 
-lval* lval_join(lval* x, lval* y) {
+// in-place inserts every cell of y into x at index, and frees y
+lval* lval_splice(lval* x, int index, lval* y) {
+  x = lval_own(x);
+  int n = y->count;
 
-  /* For each cell in 'y' add it to 'x' */
-  while (y->count) {
-    x = lval_add(x, lval_pop(y, 0));
+  if (index == 0 && x->off >= n) {
+    // there is room in front, left behind by popping the head
+    x->cell -= n;
+    x->off -= n;
+  } else {
+    lval_reserve(x, n);
+    memmove(&x->cell[index + n], &x->cell[index],
+      sizeof(lval*) * (x->count - index));
   }
 
-  /* Delete the empty 'y' and return 'x' */
+  // someone else still holds 'y', so share its cells rather than taking them
+  if (y->refs == 1 && !y->backing) {
+    memcpy(&x->cell[index], y->cell, sizeof(lval*) * n);
+    y->count = 0;
+  } else {
+    for (int i = 0; i < n; i++) {
+      x->cell[index + i] = lval_copy(y->cell[i]);
+    }
+  }
+
+  x->count += n;
   lval_del(y);
+
   return x;
 }
 
+// a window onto count cells of list starting at start, which shares the
+// cells rather than copying them, takes over the reference to list
+lval* lval_slice(lval* list, int start, int count) {
+
+  // nothing to look at, so don't keep the original alive for it
+  if (count == 0) {
+    lval* empty = (list->type == LVAL_QEXPR) ? lval_qexpr() : lval_sexpr();
+    lval_del(list);
+    return empty;
+  }
+
+  lval* v = lval_alloc();
+  v->type = list->type;
+  v->refs = 1;
+  v->count = count;
+  v->cap = 0;
+  v->off = 0;
+  v->cell = list->cell + start;
+  v->code = 0;
+
+  // windows onto windows look straight into the underlying list
+  if (list->backing) {
+    v->backing = lval_copy(list->backing);
+    lval_del(list);
+  } else {
+    v->backing = list;
+  }
+
+  return v;
+}
+
+// the first item of a list, as a list, takes over the reference to list
+lval* lval_head(lval* list) {
+  // if someone else holds the list just look at the front of it
+  if (list->refs != 1 || list->backing) {
+    return lval_slice(list, 0, 1);
+  }
+
+  list = lval_own(list);
+  while (list->count > 1) {
+    lval_del(lval_pop(list, list->count - 1));
+  }
+
+  return list;
+}
+
+// all but the first item of a list, takes over the reference to list
+lval* lval_tail(lval* list) {
+  // if someone else holds the list just look at the rest of it, so
+  // walking a list by repeated tails never copies it
+  if (list->refs != 1 || list->backing) {
+    return lval_slice(list, 1, list->count - 1);
+  }
+
+  list = lval_own(list);
+  lval_del(lval_pop(list, 0));
+  return list;
+}
+
+lval* lval_join(lval* x, lval* y) {
+  return lval_splice(x, x->count, y);
+}
+
+// copying is just taking another reference, values are shared until
+// somebody wants to modify one, see lval_own
 lval* lval_copy(lval* org) {
-  lval* dup = malloc(sizeof(lval));
+  if (org->refs != LVAL_IMMORTAL) { org->refs++; }
+  return org;
+}
+
+// a fresh, unshared, shallow duplicate, children are shared with the original
+static lval* lval_dup(lval* org) {
+  lval* dup = lval_alloc();
   dup->type = org->type;
+  dup->refs = 1;
 
   switch (dup->type) {
     case LVAL_FUN:
       if (org->builtin) {
         dup->builtin = org->builtin;
+        dup->info = org->info;
       } else {
         dup->builtin = NULL;
         dup->env = lenv_copy(org->env);
@@ -124,9 +363,44 @@ lval* lval_copy(lval* org) {
         dup->body = lval_copy(org->body);
       }
       break;
+    case LVAL_PARTIAL:
+      dup->applied = lval_copy(org->applied);
+      dup->bound = lval_copy(org->bound);
+      break;
+    // the results are only a cache, so a copy starts out without them
+    case LVAL_MEMO:
+      dup->memo = lmemo_new(lval_copy(lmemo_fn(org->memo)), lmemo_capacity(org->memo));
+      break;
+    case LVAL_MAP:
+      dup->map = lmap_copy(org->map);
+      break;
+    case LVAL_LAZY:
+      dup->promised = lval_copy(org->promised);
+      dup->scope = org->scope ? lenv_copy(org->scope) : NULL;
+      break;
+    case LVAL_SEQ:
+      dup->first = lval_copy(org->first);
+      dup->rest = lval_copy(org->rest);
+      break;
     case LVAL_NUM:
       dup->num = org->num;
       break;
+    case LVAL_DBL:
+      dup->dbl = org->dbl;
+      break;
+    case LVAL_VEC:
+      dup->vec_ints = lmem_alloc(sizeof(long) * (org->vec_count ? org->vec_count : 1));
+      memcpy(dup->vec_ints, org->vec_ints, sizeof(long) * org->vec_count);
+      dup->vec_count = org->vec_count;
+      dup->vec_float = org->vec_float;
+      dup->vec_backing = NULL;
+      break;
+    case LVAL_BIG:
+      dup->limbs = lmem_alloc(sizeof(unsigned int) * org->limbs_count);
+      memcpy(dup->limbs, org->limbs, sizeof(unsigned int) * org->limbs_count);
+      dup->limbs_count = org->limbs_count;
+      dup->negative = org->negative;
+      break;
     case LVAL_SIG:
       dup->sig = org->sig;
       break;
@@ -134,22 +408,25 @@ lval* lval_copy(lval* org) {
       dup->boolean = org->boolean;
       break;
     case LVAL_SYM:
-      dup->sym = malloc(strlen(org->sym) + 1);
-      strcpy(dup->sym, org->sym);
+      dup->sym = org->sym;
+      dup->depth = org->depth;
+      dup->slot = org->slot;
       break;
     case LVAL_STR:
-      dup->str = malloc(strlen(org->str) + 1);
-      strcpy(dup->str, org->str);
+      dup->str = lstr_dup(org->str);
       break;
     case LVAL_ERR:
-      dup->err = malloc(strlen(org->err) + 1);
-      strcpy(dup->sym, org->sym);
+      dup->err = lstr_dup(org->err);
       break;
 
     case LVAL_SEXPR:
     case LVAL_QEXPR:
       dup->count = org->count;
-      dup->cell = malloc(sizeof(lval*) * dup->count);
+      dup->cap = org->count;
+      dup->off = 0;
+      dup->backing = NULL;
+      dup->code = 0;
+      dup->cell = dup->count ? lmem_alloc(sizeof(lval*) * dup->count) : NULL;
 
       for(int i = 0; i < dup->count; i++) {
         dup->cell[i] = lval_copy(org->cell[i]);
@@ -159,13 +436,39 @@ lval* lval_copy(lval* org) {
   return dup;
 }
 
+// returns a value we may safely modify in place, takes over the reference
+// passed in, so use it like 'v = lval_own(v)'
+lval* lval_own(lval* v) {
+  int list = v->type == LVAL_SEXPR || v->type == LVAL_QEXPR;
+  if (v->refs == 1 && !(list && v->backing)) {
+    // it's about to change, so whatever it was compiled to won't be right
+    if (list && v->code) {
+      lvm_release(v->code);
+      v->code = 0;
+    }
+    return v;
+  }
+
+  lval* dup = lval_dup(v);
+  lval_del(v);
+  return dup;
+}
+
 // LOGIC
 
 // I choose to define every non-false, non-nil value as true
 int lval_true(lval* val) {
   switch (val->type) {
     case LVAL_FUN:
+    case LVAL_PARTIAL:
+    case LVAL_MEMO:
+    case LVAL_LAZY:
+    case LVAL_SEQ:
     case LVAL_NUM:
+    case LVAL_BIG:
+    case LVAL_DBL:
+    case LVAL_VEC:
+    case LVAL_MAP:
     case LVAL_SYM:
     case LVAL_SEXPR:
     case LVAL_QEXPR:
@@ -177,51 +480,271 @@ int lval_true(lval* val) {
   return 0;
 }
 
+// whether v can be called
+int lval_callable(lval* v) {
+  return v->type == LVAL_FUN || v->type == LVAL_PARTIAL || v->type == LVAL_MEMO;
+}
+
+// whether v is a special form, which is called with the rest of the
+// expression as it is, see LB_SPECIAL
+int lval_special(lval* v) {
+  return v->type == LVAL_FUN && v->builtin && (v->info->flags & LB_SPECIAL);
+}
+
+// COMPARING
+
+// structural hashing and equality, so values can be used as keys, see
+// memo.c, lists are walked with a stack of their own rather than
+// recursing, so deep ones are fine
+
+// user functions are the same if they're made of the same pieces, the
+// same body and formals closed over the same environment
+
+static lval** walk = NULL;
+static int walk_count = 0;
+static int walk_cap = 0;
+
+static void lval_walk(lval* v) {
+  if (walk_count == walk_cap) {
+    walk_cap = walk_cap ? walk_cap * 2 : 64;
+    walk = lmem_realloc(walk, sizeof(lval*) * walk_cap);
+  }
+  walk[walk_count++] = v;
+}
+
+// fnv-1a, a word at a time
+static unsigned long lval_mix(unsigned long h, unsigned long x) {
+  return (h ^ x) * 1099511628211ul;
+}
+
+static unsigned long lval_mix_str(unsigned long h, char* s) {
+  while (*s) { h = lval_mix(h, (unsigned char)*s++); }
+  return h;
+}
+
+// 0.0 and -0.0 are equal, so hash the same
+static unsigned long lval_mix_dbl(unsigned long h, double d) {
+  if (d == 0) { d = 0; }
+  unsigned long bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return lval_mix(h, bits);
+}
+
+unsigned long lval_hash(lval* v) {
+  unsigned long h = 14695981039346656037ul;
+  int base = walk_count;
+  lval_walk(v);
+
+  while (walk_count > base) {
+    lval* x = walk[--walk_count];
+    h = lval_mix(h, x->type);
+
+    switch (x->type) {
+      case LVAL_NUM: h = lval_mix(h, x->num); break;
+      case LVAL_VEC:
+        h = lval_mix(h, x->vec_float);
+        for (long i = 0; i < x->vec_count; i++) {
+          h = x->vec_float ? lval_mix_dbl(h, x->vec_dbls[i]) : lval_mix(h, x->vec_ints[i]);
+        }
+        break;
+      case LVAL_BIG:
+        h = lval_mix(h, x->negative);
+        for (int i = 0; i < x->limbs_count; i++) { h = lval_mix(h, x->limbs[i]); }
+        break;
+      case LVAL_DBL: h = lval_mix_dbl(h, x->dbl); break;
+      case LVAL_BOOL: h = lval_mix(h, x->boolean); break;
+      case LVAL_SIG: h = lval_mix(h, x->sig); break;
+      case LVAL_ERR: h = lval_mix_str(h, x->err); break;
+      case LVAL_STR: h = lval_mix_str(h, x->str); break;
+      // interned
+      case LVAL_SYM: h = lval_mix(h, (unsigned long)x->sym); break;
+      case LVAL_FUN:
+        h = lval_mix(h, x->builtin ? (unsigned long)x->info : (unsigned long)x->body);
+        break;
+      case LVAL_PARTIAL:
+        h = lval_mix(h, (unsigned long)x->applied->body);
+        lval_walk(x->bound);
+        break;
+      case LVAL_MEMO: h = lval_mix(h, (unsigned long)x->memo); break;
+      // maps change, so are only ever themselves, their keys are what's
+      // hashed structurally
+      case LVAL_MAP: h = lval_mix(h, (unsigned long)x->map); break;
+      // hashing mustn't force anything, so these are only ever themselves
+      case LVAL_LAZY:
+      case LVAL_SEQ: h = lval_mix(h, (unsigned long)x); break;
+      case LVAL_SEXPR:
+      case LVAL_QEXPR:
+        h = lval_mix(h, x->count);
+        // last first, so they come off the stack in order
+        for (int i = x->count - 1; i >= 0; i--) { lval_walk(x->cell[i]); }
+        break;
+    }
+  }
+  return h;
+}
+
+int lval_equal(lval* x, lval* y) {
+  int base = walk_count;
+  lval_walk(x);
+  lval_walk(y);
+
+  while (walk_count > base) {
+    lval* b = walk[--walk_count];
+    lval* a = walk[--walk_count];
+    if (a == b) { continue; }
+
+    int same = a->type == b->type;
+    if (same) {
+      switch (a->type) {
+        case LVAL_NUM: same = a->num == b->num; break;
+        case LVAL_DBL: same = a->dbl == b->dbl; break;
+        case LVAL_VEC:
+          same = a->vec_float == b->vec_float && a->vec_count == b->vec_count;
+          for (long i = 0; same && i < a->vec_count; i++) {
+            same = a->vec_float ? a->vec_dbls[i] == b->vec_dbls[i]
+                                : a->vec_ints[i] == b->vec_ints[i];
+          }
+          break;
+        case LVAL_BIG:
+          same = a->negative == b->negative && a->limbs_count == b->limbs_count &&
+            memcmp(a->limbs, b->limbs, sizeof(unsigned int) * a->limbs_count) == 0;
+          break;
+        case LVAL_BOOL: same = a->boolean == b->boolean; break;
+        case LVAL_SIG: same = a->sig == b->sig; break;
+        case LVAL_ERR: same = strcmp(a->err, b->err) == 0; break;
+        case LVAL_STR: same = strcmp(a->str, b->str) == 0; break;
+        case LVAL_SYM: same = a->sym == b->sym; break;
+        case LVAL_FUN:
+          if (a->builtin || b->builtin) {
+            same = a->builtin && b->builtin && a->info == b->info;
+          } else {
+            same = a->env == b->env && a->formals == b->formals && a->body == b->body;
+          }
+          break;
+        case LVAL_PARTIAL:
+          lval_walk(a->applied);
+          lval_walk(b->applied);
+          lval_walk(a->bound);
+          lval_walk(b->bound);
+          break;
+        case LVAL_MEMO: same = a->memo == b->memo; break;
+        case LVAL_MAP: same = a->map == b->map; break;
+        case LVAL_LAZY:
+        case LVAL_SEQ: same = 0; break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+          same = a->count == b->count;
+          for (int i = 0; same && i < a->count; i++) {
+            lval_walk(a->cell[i]);
+            lval_walk(b->cell[i]);
+          }
+          break;
+      }
+    }
+
+    if (!same) {
+      walk_count = base;
+      return 0;
+    }
+  }
+  return 1;
+}
+
 //
 //
 // EVALUATION
 //
 //
-lval* lval_call(lenv* env, lval* fn, lval* args) {
 
+// whether formals are just distinct symbols, with no '&', so the
+// arguments can go straight into slots in the order they're given
+static int lval_fixed(lval* formals) {
+  if (formals->count > LENV_SLOTS) { return 0; }
+  for (int i = 0; i < formals->count; i++) {
+    char* sym = formals->cell[i]->sym;
+    if (sym == lsym_rest) { return 0; }
+    for (int j = 0; j < i; j++) {
+      if (formals->cell[j]->sym == sym) { return 0; }
+    }
+  }
+  return 1;
+}
 
-  // immediately return builtin functions, thats easy
-  if (fn->builtin) {
-    return fn->builtin(env, args);
+// whether '&' comes within the first n formals, or right after them,
+// when the call can always be made
+static int lval_rest_within(lval* formals, int n) {
+  for (int i = 0; i <= n && i < formals->count; i++) {
+    if (formals->cell[i]->sym == lsym_rest) { return 1; }
+  }
+  return 0;
+}
+
+// binds args to the formals of the user function fn in a new frame below
+// the environment it was created in, returns NULL once every formal is
+// bound, handing the frame back to evaluate the body in, and otherwise an
+// error or the partially applied function
+// takes over args but not fn
+lval* lval_bind(lval* fn, lval* args, lenv** out) {
+
+  // the usual case, every argument given to a function without '&',
+  // they're moved straight into a frame of the right size
+  if (args->count == fn->formals->count && lval_fixed(fn->formals)) {
+    if (args->refs == 1 && !args->backing) {
+      *out = lenv_frame(fn->env, fn->formals, args->cell);
+      args->count = 0;
+    } else {
+      for (int i = 0; i < args->count; i++) { lval_copy(args->cell[i]); }
+      *out = lenv_frame(fn->env, fn->formals, args->cell);
+    }
+    lval_del(args);
+    return NULL;
+  }
+
+  lval* formals = fn->formals;
+
+  // or if it's short of arguments, without getting as far as any '&', it
+  // waits on the rest, holding on to those it has
+  if (args->count < formals->count && !lval_rest_within(formals, args->count)) {
+    if (args->count == 0) {
+      lval_del(args);
+      return lval_copy(fn);
+    }
+    return lval_partial(fn, args);
   }
 
+  // arguments are bound into a fresh frame for this call, whose parent is
+  // the environment the function was created in
+  lenv* frame = lenv_new();
+  frame->parent = lenv_copy(fn->env);
+
   // are we create a new expression or evaluating?
   int given = args->count;
-  int total = fn->formals->count;
+  int total = formals->count;
+  int bound = 0;
 
   while(args->count) {
-    if (fn->formals->count == 0) {
+    if (bound == formals->count) {
       lval_del(args);
+      lenv_del(frame);
       return lval_err("function passed too many arguments, %i for %i",
                given, total);
     }
 
-    lval* ref = lval_pop(fn->formals, 0);
+    lval* ref = formals->cell[bound++];
 
     // handle rest operator "&" arguments
-    // there needs to be at least formal left, to which we assign the rest of the arguments
-    if ((fn->formals->count > 0) && (strcmp(ref->sym, "&") == 0)) {
+    // there needs to be exactly one formal left, to which we assign the rest of the arguments
+    if (ref->sym == lsym_rest) {
 
-      // also,
-      if (fn->formals->count != 2) {
+      if (bound != formals->count - 1) {
         lval_del(args);
-        return lval_err("arguments supplied to function are incorrect");
+        lenv_del(frame);
+        return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
       }
 
-      // copied->edited this bit out since it was more efficient
-      // just pop off the rest of the formals
-      lval* nref = lval_pop(fn->formals, 0);
       // just switch the type to quoted expression, how nice, no need to make dups
-      lenv_put(fn->env, nref, builtin_quote(env, args));
-
-      // then cleanup
-      lval_del(nref);
-      lval_del(ref);
+      args = builtin_quote(frame, args);
+      lenv_put(frame, formals->cell[bound++], args);
       break;
     }
 
@@ -230,19 +753,18 @@ lval* lval_call(lenv* env, lval* fn, lval* args) {
     lval* val = lval_pop(args, 0);
 
     // place into the functions local environment
-    lenv_put(fn->env, ref, val);
+    lenv_put(frame, ref, val);
 
     // then cleanup
-    lval_del(ref);
     lval_del(val);
   }
 
   // before we return a new expression or evaluate this call
   // &, the spread operator might be in the formal list,
-  // no variable args were given, so pop off that formal
+  // no variable args were given, so skip that formal
   // and give it an empty {} as it's value so it receives
   // an expected type
-  if (fn->formals->count > 0 && strcmp(fn->formals->cell[0]->sym, "&") == 0) {
+  if (bound < formals->count && formals->cell[bound]->sym == lsym_rest) {
 
     // also prevent people from defining invalid functions, well, sort of...
     //
@@ -250,49 +772,171 @@ lval* lval_call(lenv* env, lval* fn, lval* args) {
     // your function definition was wrong because it's ambiguous
     // we don't know how to map m arguments to n symbols arbitrarily.
     // therefore only one symbol can follow the rest operator
-    if (fn->formals->count != 2) {
+    if (formals->count - bound != 2) {
+      lval_del(args);
+      lenv_del(frame);
       return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
     }
 
     // now is the the actual case of, I just didn't have any variable arguments
-    // remove the '&'
-    lval_del(lval_pop(fn->formals, 0));
-
-    // Take next formal which is symbol representing the rest of the args
-    lval* ref = lval_pop(fn->formals, 0);
-
-    // make an empty val for it
+    // make an empty val for the symbol after the '&'
     lval* val = lval_qexpr();
 
     // store a copy of it in the environment
-    lenv_put(fn->env, ref, val);
-
-    // free the originals
-    lval_del(ref);
+    lenv_put(frame, formals->cell[bound + 1], val);
     lval_del(val);
+
+    bound += 2;
   }
 
   // everything is bound at this point, clean this up
   lval_del(args);
 
-  // now actually evaluate, if we can
-  if(fn->formals->count == 0) {
-    // we're going to create a new sexpr here,
-    // and in-place add a copy of the function body as it's first argument
-    // and builtin_eval will then be able to evaluate that function body
-    // within the context of the environment to which we've just added vars too
-    fn->env->parent = env;
-    lval* newexpr = lval_add(lval_sexpr(), lval_copy(fn->body));
-    return builtin_eval(fn->env, newexpr);
-
-  // or return a new expression since we can't evaluate yet
-  } else {
-    // return a copy of
-    return lval_copy(fn);
+  // ready to evaluate, anything short of arguments was caught above
+  *out = frame;
+  return NULL;
+}
+
+// the arguments a partially applied *fn has already, followed by args,
+// with *fn replaced by the function it's waiting to call, takes over both
+lval* lval_applied(lval** fn, lval* args) {
+  lval* partial = *fn;
+  lval* all = lval_splice(lval_copy(partial->bound), partial->bound->count, args);
+  all->type = LVAL_SEXPR;
+
+  *fn = lval_copy(partial->applied);
+  lval_del(partial);
+  return all;
+}
+
+// builtins which end by evaluating something in the environment they
+// were called in, such as 'if' and 'eval', return lval_defer(x) instead,
+// so whoever called them carries on with x, rather than the builtin
+// recursing into lval_eval, x is evaluated as a s-expression whether it
+// is one or a quoted expression, so a branch needn't be copied to retype it
+static lval deferred;
+static lval* deferred_expr = NULL;
+static lenv* deferred_env = NULL;
+
+lval* lval_defer(lval* x) {
+  deferred_expr = x;
+  return &deferred;
+}
+
+// the same, but carrying on in env, such as the frame 'let' makes, takes
+// over its reference
+lval* lval_defer_in(lenv* env, lval* x) {
+  deferred_env = env;
+  return lval_defer(x);
+}
+
+// the list left to evaluate when result came from lval_defer, otherwise
+// NULL, *env is where, with a reference, or NULL for where it was called
+lval* lval_deferred(lval* result, lenv** env) {
+  if (result != &deferred) { return NULL; }
+
+  lval* x = deferred_expr;
+  *env = deferred_env;
+  deferred_expr = NULL;
+  deferred_env = NULL;
+  return x;
+}
+
+// takes over both the function and its arguments, and returns the result,
+// or NULL when all that's left to do is evaluate *next in *next_env, such
+// as the body of a user function, so the caller can carry on with that
+// itself and calls in tail position don't grow the stack
+// *next_env comes with a reference
+static lval* lval_call(lenv* env, lval* fn, lval* args, lenv** next_env, lval** next) {
+
+  // memoised, it's either been worked out before, or it's worked out here
+  // rather than by whoever called us, so the result can be kept
+  if (fn->type == LVAL_MEMO) {
+    lval* result = lmemo_get(fn->memo, args);
+    if (!result) {
+      lval* key = lval_copy(args);
+      lenv* body_env;
+      lval* body;
+      result = lval_call(env, lval_copy(lmemo_fn(fn->memo)), args, &body_env, &body);
+      if (!result) {
+        result = lval_eval(body_env, body);
+        lenv_del(body_env);
+      }
+
+      if (result->type != LVAL_ERR) {
+        lmemo_put(fn->memo, key, result);
+      } else {
+        lval_del(key);
+      }
+    } else {
+      lval_del(args);
+    }
+    lval_del(fn);
+    return result;
+  }
+
+  // a partially applied function is called with everything it's been given
+  if (fn->type == LVAL_PARTIAL) { args = lval_applied(&fn, args); }
+
+  // immediately return builtin functions, thats easy
+  if (fn->builtin) {
+    lval* result = lbuiltin_call(env, fn, args);
+    lval_del(fn);
+
+    lenv* later_env;
+    lval* later = lval_deferred(result, &later_env);
+    if (later) {
+      *next_env = later_env ? later_env : lenv_copy(env);
+      *next = later;
+      return NULL;
+    }
+    return result;
+  }
+
+  lenv* frame;
+  lval* result = lval_bind(fn, args, &frame);
+
+  // now actually evaluate, if we can, the body as an s-expression in the
+  // frame to which we've just added vars too
+  if (!result) {
+    lval* body = lval_own(lval_copy(fn->body));
+    body->type = LVAL_SEXPR;
+
+    *next_env = frame;
+    *next = body;
+  }
+
+  lval_del(fn);
+  return result;
+}
+
+// which evaluator s-expressions go to
+int leval_mode = LEVAL_VM;
+
+// how many calls deep evaluation may go, 0 for no limit
+int leval_max_depth = LEVAL_MAX_DEPTH;
+
+lval* lval_too_deep(void) {
+  if (leval_mode == LEVAL_TREE &&
+      (leval_max_depth == 0 || leval_max_depth > LEVAL_TREE_MAX_DEPTH)) {
+    return lval_err("maximum evaluation depth of %i exceeded", LEVAL_TREE_MAX_DEPTH);
   }
+  return lval_err("maximum evaluation depth of %i exceeded", leval_max_depth);
+}
+
+// how deep the tree walker is, it recurses in C for every nested call, so
+// whatever the cap it stops short of running out of C stack
+static int depth = 0;
+
+static int lval_too_deep_for_c(void) {
+  if (depth >= LEVAL_TREE_MAX_DEPTH) { return 1; }
+  return leval_max_depth > 0 && depth >= leval_max_depth;
 }
 
 lval* lval_eval(lenv* env, lval* val) {
+  // a safe point, every reference is held by something we can see
+  lgc_maybe_collect();
+
   if (val->type == LVAL_SYM) {
     lval* reference = lenv_get(env, val);
     lval_del(val);
@@ -300,44 +944,97 @@ lval* lval_eval(lenv* env, lval* val) {
     return reference;
   }
 
-  if (val->type == LVAL_SEXPR) { return lval_eval_sexpr(env, val); }
+  if (val->type == LVAL_SEXPR) {
+    if (leval_mode == LEVAL_VM) { return lvm_eval(env, val); }
+    return lval_eval_sexpr(env, val);
+  }
 
   // or just return self
   return val;
 }
 
 lval* lval_eval_sexpr(lenv* env, lval* expr) {
+  if (lval_too_deep_for_c()) {
+    lval_del(expr);
+    return lval_too_deep();
+  }
+  depth++;
+
+  // once a call in tail position has moved us on into another frame, we
+  // hold a reference to it
+  lenv* held = NULL;
+  lval* result = NULL;
+
+  while (!result) {
+    // a quoted expression deferred to us, see lval_defer
+    if (expr->type == LVAL_QEXPR) {
+      expr = lval_own(expr);
+      expr->type = LVAL_SEXPR;
+    }
 
-  // evaluate children
-  for (int i = 0; i < expr->count; i++) {
-    // point to the evaluation results on this exprs cells
-    expr->cell[i] = lval_eval(env, expr->cell[i]);
+    // an empty expr case, return self
+    if (expr->count == 0) {
+      result = expr;
+      break;
+    }
 
-    // if we hit an error though, return immediately...
-    if (expr->cell[i]->type == LVAL_ERR) { return lval_take(expr, i); };
-  }
+    // children get replaced by their values, so this has to be ours
+    expr = lval_own(expr);
 
-  // an empty expr case, return self
-  if (expr->count == 0) { return expr; }
+    // just an expression in brackets, so carry on with that
+    if (expr->count == 1 && expr->cell[0]->type == LVAL_SEXPR) {
+      expr = lval_take(expr, 0);
+      continue;
+    }
 
-  // single expr, return the inner
-  if (expr->count == 1) { return lval_take(expr, 0); }
+    // evaluate children
+    for (int i = 0; i < expr->count; i++) {
+      // point to the evaluation results on this exprs cells, the child is
+      // handed over to lval_eval, so the cell mustn't go on pointing at it
+      // in the meantime or the collector would count a reference that's gone
+      lval* child = expr->cell[i];
+      expr->cell[i] = lval_nil();
+      expr->cell[i] = lval_eval(env, child);
+
+      // if we hit an error though, return immediately...
+      if (expr->cell[i]->type == LVAL_ERR) {
+        result = lval_take(expr, i);
+        break;
+      }
 
-  // validate syntax, the first element must as always be a function
-  lval* fn = lval_pop(expr, 0);
+      // a special form evaluates the rest itself
+      if (i == 0 && expr->count > 1 && lval_special(expr->cell[0])) { break; }
+    }
+    if (result) { break; }
 
-  if (fn->type != LVAL_FUN) {
-    lval* err = lval_err("incorrect type found when evaluating a symbolic expression, '%s' is not a function", lval_human_name(fn->type));
-    lval_del(fn);
-    lval_del(expr);
-    return err;
-  }
+    // single expr, return the inner
+    if (expr->count == 1) {
+      result = lval_take(expr, 0);
+      break;
+    }
 
-  // Actually call the expression
-  lval* result = lval_call(env, fn, expr);
+    // validate syntax, the first element must as always be a function
+    lval* fn = lval_pop(expr, 0);
 
-  // free the operand
-  lval_del(fn);
+    if (!lval_callable(fn)) {
+      result = lval_err("incorrect type found when evaluating a symbolic expression, '%s' is not a function", lval_human_name(fn->type));
+      lval_del(fn);
+      lval_del(expr);
+      break;
+    }
+
+    // Actually call the expression, which takes care of freeing fn and
+    // expr, and either gives us the result or what to evaluate next
+    lenv* next_env;
+    result = lval_call(env, fn, expr, &next_env, &expr);
+
+    if (!result) {
+      if (held) { lenv_del(held); }
+      env = held = next_env;
+    }
+  }
 
+  if (held) { lenv_del(held); }
+  depth--;
   return result;
 }
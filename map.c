@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// MAPS
+//
+//
+
+// a map from numbers, strings and symbols to anything, the keys are
+// compared structurally, see lval_hash and lval_equal
+
+// unlike everything else a map is changed in place by map-put and map-del,
+// whatever holds it sees the change, that's what makes them O(1) rather
+// than a copy per put
+
+// open addressing, robin hood, each entry keeps how far it ended up from
+// where its hash would have put it, an insert takes the slot of anything
+// which is closer to home than it is, so the probes stay short and a
+// lookup can stop as soon as it passes something closer to home than it
+// would be, deletes shift what follows back rather than leaving tombstones
+
+typedef struct lmap_slot {
+  unsigned long hash;
+  // both hold a reference, key is NULL when the slot is empty
+  lval* key;
+  lval* value;
+  int dist;
+} lmap_slot;
+
+struct lmap {
+  lmap_slot* slots;
+  int count;
+  int cap;
+};
+
+#define LMAP_MIN_CAP 8
+
+static lmap_slot* lmap_slots(int cap) {
+  lmap_slot* slots = lmem_alloc(sizeof(lmap_slot) * cap);
+  for (int i = 0; i < cap; i++) { slots[i].key = NULL; }
+  return slots;
+}
+
+lmap* lmap_new(void) {
+  lmap* m = lmem_alloc(sizeof(lmap));
+  m->slots = lmap_slots(LMAP_MIN_CAP);
+  m->count = 0;
+  m->cap = LMAP_MIN_CAP;
+  return m;
+}
+
+int lmap_count(lmap* m) {
+  return m->count;
+}
+
+// whether k can be a key, floats which aren't equal to themselves can't
+// ever be found again
+int lmap_key_ok(lval* k) {
+  switch (k->type) {
+    case LVAL_NUM:
+    case LVAL_BIG:
+    case LVAL_STR:
+    case LVAL_SYM: return 1;
+    case LVAL_DBL: return k->dbl == k->dbl;
+    default: return 0;
+  }
+}
+
+// calls fn on every key and value, other than the immortal ones, for the
+// collector and for taking it apart
+#define LMAP_VISIT(fn, v) if ((v)->refs != LVAL_IMMORTAL) { fn(v); }
+
+void lmap_each(lmap* m, void (*fn)(lval*)) {
+  for (int i = 0; i < m->cap; i++) {
+    if (!m->slots[i].key) { continue; }
+    LMAP_VISIT(fn, m->slots[i].key);
+    LMAP_VISIT(fn, m->slots[i].value);
+  }
+}
+
+// the slot of the first entry after slot i, or -1, for going through it
+// in no particular order
+int lmap_next(lmap* m, int i, lval** key, lval** value) {
+  for (i++; i < m->cap; i++) {
+    if (m->slots[i].key) {
+      *key = m->slots[i].key;
+      *value = m->slots[i].value;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// frees the table, without touching anything it refers to
+void lmap_free(lmap* m) {
+  lmem_free(m->slots);
+  lmem_free(m);
+}
+
+// another table with the same entries, each holding another reference
+lmap* lmap_copy(lmap* org) {
+  lmap* m = lmem_alloc(sizeof(lmap));
+  m->slots = lmem_alloc(sizeof(lmap_slot) * org->cap);
+  memcpy(m->slots, org->slots, sizeof(lmap_slot) * org->cap);
+  m->count = org->count;
+  m->cap = org->cap;
+  for (int i = 0; i < m->cap; i++) {
+    if (!m->slots[i].key) { continue; }
+    lval_copy(m->slots[i].key);
+    lval_copy(m->slots[i].value);
+  }
+  return m;
+}
+
+//
+// the table
+//
+
+// the slot holding key, or -1
+static int lmap_find(lmap* m, lval* key, unsigned long hash) {
+  int mask = m->cap - 1;
+  int j = hash & mask;
+  for (int dist = 0; ; dist++) {
+    lmap_slot* s = &m->slots[j];
+    // anything closer to home than key would be means it isn't here
+    if (!s->key || s->dist < dist) { return -1; }
+    if (s->hash == hash && lval_equal(s->key, key)) { return j; }
+    j = (j + 1) & mask;
+  }
+}
+
+// places an entry which isn't there yet, there has to be room for it
+static void lmap_place(lmap* m, unsigned long hash, lval* key, lval* value) {
+  int mask = m->cap - 1;
+  lmap_slot carry = { hash, key, value, 0 };
+  int j = hash & mask;
+  for (;;) {
+    lmap_slot* s = &m->slots[j];
+    if (!s->key) {
+      *s = carry;
+      return;
+    }
+    // robin hood, the one further from home gets the slot, and the one
+    // it displaces carries on looking
+    if (s->dist < carry.dist) {
+      lmap_slot t = *s;
+      *s = carry;
+      carry = t;
+    }
+    j = (j + 1) & mask;
+    carry.dist++;
+  }
+}
+
+// at most 7/8 full, robin hood keeps the probes short even so
+static void lmap_grow(lmap* m) {
+  if ((m->count + 1) * 8 <= m->cap * 7) { return; }
+
+  lmap_slot* old = m->slots;
+  int old_cap = m->cap;
+  m->cap *= 2;
+  m->slots = lmap_slots(m->cap);
+  for (int i = 0; i < old_cap; i++) {
+    if (old[i].key) { lmap_place(m, old[i].hash, old[i].key, old[i].value); }
+  }
+  lmem_free(old);
+}
+
+// the value kept for key, or NULL
+lval* lmap_get(lmap* m, lval* key) {
+  int j = lmap_find(m, key, lval_hash(key));
+  return j == -1 ? NULL : lval_copy(m->slots[j].value);
+}
+
+// keeps value for key, takes over both
+void lmap_put(lmap* m, lval* key, lval* value) {
+  unsigned long hash = lval_hash(key);
+  int j = lmap_find(m, key, hash);
+
+  if (j != -1) {
+    lval_del(m->slots[j].value);
+    m->slots[j].value = value;
+    lval_del(key);
+    return;
+  }
+
+  lmap_grow(m);
+  lmap_place(m, hash, key, value);
+  m->count++;
+}
+
+// drops the entry for key, if there is one, gives whether there was
+int lmap_del(lmap* m, lval* key) {
+  int j = lmap_find(m, key, lval_hash(key));
+  if (j == -1) { return 0; }
+
+  lval_del(m->slots[j].key);
+  lval_del(m->slots[j].value);
+  m->count--;
+
+  // shift back whatever follows until something's already home
+  int mask = m->cap - 1;
+  for (;;) {
+    int next = (j + 1) & mask;
+    lmap_slot* s = &m->slots[next];
+    if (!s->key || s->dist == 0) { break; }
+    m->slots[j] = *s;
+    m->slots[j].dist--;
+    j = next;
+  }
+  m->slots[j].key = NULL;
+  return 1;
+}
+
+// the keys as a q-expression
+lval* lmap_keys(lmap* m) {
+  lval* keys = lval_qexpr();
+  lval_reserve(keys, m->count);
+  for (int i = 0; i < m->cap; i++) {
+    if (m->slots[i].key) { keys = lval_add(keys, lval_copy(m->slots[i].key)); }
+  }
+  return keys;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// MEMOISING
+//
+//
+
+// a memoised function keeps the results of the calls made to it, keyed by
+// their arguments, compared structurally, see lval_hash and lval_equal
+
+// at most capacity results are kept, once it's full the one used least
+// recently makes way, entries are threaded onto a list from most to least
+// recently used for that
+
+// the entries are found through an open addressing table of their
+// positions, linear probing, kept at most half full
+
+typedef struct lmemo_entry {
+  unsigned long hash;
+  // the arguments, and the result, both hold a reference
+  lval* key;
+  lval* value;
+  // neighbours in order of use, -1 at either end
+  int newer;
+  int older;
+} lmemo_entry;
+
+struct lmemo {
+  // what's being memoised, holds a reference
+  lval* fn;
+
+  lmemo_entry* entries;
+  int count;
+  int capacity;
+
+  int* slots;
+  int slots_cap;
+
+  int newest;
+  int oldest;
+};
+
+lmemo* lmemo_new(lval* fn, int capacity) {
+  lmemo* m = lmem_alloc(sizeof(lmemo));
+  m->fn = fn;
+  m->entries = lmem_alloc(sizeof(lmemo_entry) * capacity);
+  m->count = 0;
+  m->capacity = capacity;
+
+  m->slots_cap = 16;
+  while (m->slots_cap < 2 * capacity) { m->slots_cap *= 2; }
+  m->slots = lmem_alloc(sizeof(int) * m->slots_cap);
+  for (int i = 0; i < m->slots_cap; i++) { m->slots[i] = -1; }
+
+  m->newest = m->oldest = -1;
+  return m;
+}
+
+lval* lmemo_fn(lmemo* m) {
+  return m->fn;
+}
+
+int lmemo_capacity(lmemo* m) {
+  return m->capacity;
+}
+
+// calls fn on the function and every key and result, other than the
+// immortal ones, for the collector and for taking it apart
+#define LMEMO_VISIT(fn, v) if ((v)->refs != LVAL_IMMORTAL) { fn(v); }
+
+void lmemo_each(lmemo* m, void (*fn)(lval*)) {
+  LMEMO_VISIT(fn, m->fn);
+  for (int i = 0; i < m->count; i++) {
+    LMEMO_VISIT(fn, m->entries[i].key);
+    LMEMO_VISIT(fn, m->entries[i].value);
+  }
+}
+
+// frees the table, without touching anything it refers to
+void lmemo_free(lmemo* m) {
+  lmem_free(m->entries);
+  lmem_free(m->slots);
+  lmem_free(m);
+}
+
+//
+// the order of use
+//
+
+static void lmemo_unlink(lmemo* m, int i) {
+  lmemo_entry* e = &m->entries[i];
+  if (e->newer != -1) { m->entries[e->newer].older = e->older; } else { m->newest = e->older; }
+  if (e->older != -1) { m->entries[e->older].newer = e->newer; } else { m->oldest = e->newer; }
+}
+
+static void lmemo_link(lmemo* m, int i) {
+  lmemo_entry* e = &m->entries[i];
+  e->newer = -1;
+  e->older = m->newest;
+  if (m->newest != -1) { m->entries[m->newest].newer = i; }
+  m->newest = i;
+  if (m->oldest == -1) { m->oldest = i; }
+}
+
+//
+// the table
+//
+
+// the slot holding the entry for args, or the empty one it would go in
+static int lmemo_find(lmemo* m, lval* args, unsigned long hash) {
+  int mask = m->slots_cap - 1;
+  int j = hash & mask;
+  while (m->slots[j] != -1) {
+    lmemo_entry* e = &m->entries[m->slots[j]];
+    if (e->hash == hash && lval_equal(e->key, args)) { break; }
+    j = (j + 1) & mask;
+  }
+  return j;
+}
+
+// empties slot j, moving back anything further along which would no
+// longer be found past the gap
+static void lmemo_unslot(lmemo* m, int j) {
+  int mask = m->slots_cap - 1;
+  int i = j;
+  for (;;) {
+    j = (j + 1) & mask;
+    if (m->slots[j] == -1) { break; }
+
+    // where the entry at j would rather be, it stays put when that's
+    // after the gap
+    int k = m->entries[m->slots[j]].hash & mask;
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) { continue; }
+
+    m->slots[i] = m->slots[j];
+    i = j;
+  }
+  m->slots[i] = -1;
+}
+
+// the result kept for args, or NULL
+lval* lmemo_get(lmemo* m, lval* args) {
+  int j = lmemo_find(m, args, lval_hash(args));
+  int i = m->slots[j];
+  if (i == -1) { return NULL; }
+
+  lmemo_unlink(m, i);
+  lmemo_link(m, i);
+  return lval_copy(m->entries[i].value);
+}
+
+// keeps value as the result for args, takes over args but not value
+void lmemo_put(lmemo* m, lval* args, lval* value) {
+  unsigned long hash = lval_hash(args);
+  int j = lmemo_find(m, args, hash);
+
+  // already there, a recursive call got to it first
+  if (m->slots[j] != -1) {
+    lmemo_entry* e = &m->entries[m->slots[j]];
+    lval_del(e->value);
+    e->value = lval_copy(value);
+    lval_del(args);
+    return;
+  }
+
+  int i;
+  if (m->count < m->capacity) {
+    i = m->count++;
+  } else {
+    // full, the least recently used goes
+    i = m->oldest;
+    lmemo_entry* old = &m->entries[i];
+    lmemo_unlink(m, i);
+    lmemo_unslot(m, lmemo_find(m, old->key, old->hash));
+    lval_del(old->key);
+    lval_del(old->value);
+
+    // the gap may have moved what would be found at j
+    j = lmemo_find(m, args, hash);
+  }
+
+  lmemo_entry* e = &m->entries[i];
+  e->hash = hash;
+  e->key = args;
+  e->value = lval_copy(value);
+  lmemo_link(m, i);
+  m->slots[j] = i;
+}
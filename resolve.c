@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// RESOLVING
+//
+//
+
+// when a function is created we know which symbols in its body are its
+// own arguments, and where lval_call will bind them, and which belong to
+// the environments it closes over, so each symbol is tagged with that
+// address and lenv_get can go straight to the slot
+
+// everything else is marked global, and remembers its slot in the global
+// environment the first time it is looked up
+
+// addresses are only ever hints, lenv_get checks that the slot really
+// holds the symbol before using it and falls back to searching, so a
+// body which is evaluated somewhere unexpected still sees the right thing
+
+// the slot lval_call binds sym into, or -1 when it isn't an argument
+static int lval_formal_slot(lval* formals, char* sym) {
+  int slot = 0;
+  for (int i = 0; i < formals->count; i++) {
+    // '&' itself is never bound
+    if (formals->cell[i]->sym == lsym_rest) { continue; }
+    if (formals->cell[i]->sym == sym) { return slot; }
+    slot++;
+  }
+  return -1;
+}
+
+static void lval_resolve_sym(lval* sym, lval* formals, lenv* env) {
+  int slot = lval_formal_slot(formals, sym->sym);
+  if (slot != -1) {
+    sym->depth = 0;
+    sym->slot = slot;
+    return;
+  }
+
+  // bound somewhere we close over, short of the global environment
+  int depth = 1;
+  for (lenv* e = env; e->parent; e = e->parent, depth++) {
+    slot = lenv_find(e, sym->sym);
+    if (slot != -1) {
+      sym->depth = depth;
+      sym->slot = slot;
+      return;
+    }
+  }
+
+  if (sym->depth != LSYM_GLOBAL) {
+    sym->depth = LSYM_GLOBAL;
+    sym->slot = -1;
+  }
+}
+
+// lists still to be walked, so a deeply nested body doesn't recurse
+static lval** pending = NULL;
+static int pending_count = 0;
+static int pending_cap = 0;
+
+static void lval_resolve_push(lval* list) {
+  if (pending_count == pending_cap) {
+    pending_cap = pending_cap ? pending_cap * 2 : 64;
+    pending = lmem_realloc(pending, sizeof(lval*) * pending_cap);
+  }
+  pending[pending_count++] = list;
+}
+
+// env is where the function is being created, the parent of its frames
+void lval_resolve(lval* body, lval* formals, lenv* env) {
+  int base = pending_count;
+  lval_resolve_push(body);
+
+  while (pending_count > base) {
+    lval* v = pending[--pending_count];
+    switch (v->type) {
+      case LVAL_SYM: lval_resolve_sym(v, formals, env); break;
+
+      // quoted expressions may be evaluated too, say as the branches of an 'if'
+      case LVAL_SEXPR:
+      case LVAL_QEXPR:
+        for (int i = 0; i < v->count; i++) {
+          lval_resolve_push(v->cell[i]);
+        }
+        break;
+    }
+  }
+}
@@ -13,20 +13,84 @@
 //
 //
 
+// the shared, never freed, values
+// each is filled in the first time it's asked for
+static lval small_nums[LVAL_NUM_CACHE_MAX - LVAL_NUM_CACHE_MIN + 1];
+static lval booleans[2];
+static lval nil;
+
 // returns a pointer to a number
 // takes the value of the number (long)
 lval* lval_num(long x) {
-  lval* v = malloc(sizeof(lval));
+  if (x >= LVAL_NUM_CACHE_MIN && x <= LVAL_NUM_CACHE_MAX) {
+    lval* v = &small_nums[x - LVAL_NUM_CACHE_MIN];
+    if (!v->refs) {
+      v->type = LVAL_NUM;
+      v->refs = LVAL_IMMORTAL;
+      v->num = x;
+    }
+    return v;
+  }
+
+  lval* v = lval_alloc();
   v->type = LVAL_NUM;
+  v->refs = 1;
   v->num = x;
 
   return v;
 }
 
+// takes over limbs, which bignum.c has made sure are too many for a number
+lval* lval_big(unsigned int* limbs, int count, int negative) {
+  lval* v = lval_alloc();
+  v->type = LVAL_BIG;
+  v->refs = 1;
+  v->limbs = limbs;
+  v->limbs_count = count;
+  v->negative = negative;
+
+  return v;
+}
+
+// count elements, left for the caller to fill in
+lval* lval_vec(int floats, long count) {
+  lval* v = lval_alloc();
+  v->type = LVAL_VEC;
+  v->refs = 1;
+  v->vec_ints = lmem_alloc(sizeof(long) * (count ? count : 1));
+  v->vec_count = count;
+  v->vec_float = floats;
+  v->vec_backing = NULL;
+
+  return v;
+}
+
+lval* lval_map(void) {
+  lval* v = lval_alloc();
+  v->type = LVAL_MAP;
+  v->refs = 1;
+  v->map = lmap_new();
+
+  return v;
+}
+
+lval* lval_dbl(double x) {
+  lval* v = lval_alloc();
+  v->type = LVAL_DBL;
+  v->refs = 1;
+  v->dbl = x;
+
+  return v;
+}
+
+// true and false are shared
 lval* lval_bool(int x) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_BOOL;
-  v->boolean = x;
+  lval* v = &booleans[x ? 1 : 0];
+  if (!v->refs) {
+    v->type = LVAL_BOOL;
+    v->refs = LVAL_IMMORTAL;
+    v->boolean = x ? 1 : 0;
+  }
 
   return v;
 }
@@ -34,8 +98,9 @@ lval* lval_bool(int x) {
 // returns a pointer to a signal
 // takes the value of the signal (int)
 lval* lval_sig(int x) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_SIG;
+  v->refs = 1;
   v->sig = x;
 
   return v;
@@ -44,29 +109,33 @@ lval* lval_sig(int x) {
 // returns a pointer to an error lval
 // takes a message
 lval* lval_err(char* message, ...) {
-  lval* e = malloc(sizeof(lval));
+  lval* e = lval_alloc();
   e->type = LVAL_ERR;
+  e->refs = 1;
 
   va_list va;
   va_start(va, message);
 
-  // allocate a finite space...
-  e->err = malloc(512);
-
-  vsnprintf(e->err, 511, message, va);
+  // format into a finite space, then keep only what we need
+  char buffer[512];
+  vsnprintf(buffer, 511, message, va);
 
   va_end(va);
 
+  e->err = lstr_dup(buffer);
+
   return e;
 }
 
 // returns a pointer to an symbol lval
 // takes the value of the symbol
 lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_SYM;
-  v->sym  = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
+  v->refs = 1;
+  v->sym  = lsym_intern(s);
+  v->depth = LSYM_UNRESOLVED;
+  v->slot = -1;
 
   return v;
 }
@@ -74,53 +143,83 @@ lval* lval_sym(char* s) {
 // returns a pointer to an symbol lval
 // takes the value of the symbol
 lval* lval_str(char* s) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_STR;
-  v->str  = malloc(strlen(s) + 1);
-  strcpy(v->str, s);
+  v->refs = 1;
+  v->str  = lstr_dup(s);
 
   return v;
 }
 
 // return a pointer to a quoted expression
 lval* lval_qexpr(void) {
-  lval* q = malloc(sizeof(lval));
+  lval* q = lval_alloc();
   q->type = LVAL_QEXPR;
+  q->refs = 1;
 
   q->count = 0;
+  q->cap = 0;
+  q->off = 0;
   q->cell = NULL;
+  q->backing = NULL;
+  q->code = 0;
 
   return q;
 }
 
 // return a pointer to an s-expression
 lval* lval_sexpr(void) {
-  lval* s = malloc(sizeof(lval));
+  lval* s = lval_alloc();
   s->type = LVAL_SEXPR;
+  s->refs = 1;
 
   // initialize at zero since we're taking no arguments...
   s->count = 0;
+  s->cap = 0;
+  s->off = 0;
   s->cell = NULL;
+  s->backing = NULL;
+  s->code = 0;
 
   return s;
 }
 
-lval* lval_fun(lbuiltin fn) {
-  lval* f = malloc(sizeof(lval));
+// the shared empty s-expression, which builtins return when there
+// is nothing more useful to say
+lval* lval_nil(void) {
+  if (!nil.refs) {
+    nil.type = LVAL_SEXPR;
+    nil.refs = LVAL_IMMORTAL;
+    nil.count = 0;
+    nil.cap = 0;
+    nil.off = 0;
+    nil.cell = NULL;
+    nil.backing = NULL;
+    nil.code = 0;
+  }
+
+  return &nil;
+}
+
+lval* lval_fun(lbuiltin_info* info) {
+  lval* f = lval_alloc();
   f->type = LVAL_FUN;
-  f->builtin = fn;
+  f->refs = 1;
+  f->builtin = info->fn;
+  f->info = info;
   return f;
 }
 
-lval* lval_lambda(lval* formals, lval* body) {
-  lval* f = malloc(sizeof(lval));
+lval* lval_lambda(lenv* env, lval* formals, lval* body) {
+  lval* f = lval_alloc();
   f->type = LVAL_FUN;
+  f->refs = 1;
 
   // these are user defined functions, not built in ones
   f->builtin = NULL;
 
-  // vars contained within the scope of the function body;
-  f->env = lenv_new();
+  // closes over the environment it was created in
+  f->env = lenv_copy(env);
 
   // arguments and fn body
   f->formals = formals;
@@ -128,3 +227,48 @@ lval* lval_lambda(lval* formals, lval* body) {
 
   return f;
 }
+
+// the user function fn, waiting on the rest of its arguments, takes over
+// the list of those it has already
+lval* lval_partial(lval* fn, lval* bound) {
+  lval* p = lval_alloc();
+  p->type = LVAL_PARTIAL;
+  p->refs = 1;
+  p->applied = lval_copy(fn);
+  p->bound = bound;
+
+  return p;
+}
+
+// fn, keeping up to capacity of its results
+lval* lval_memo(lval* fn, int capacity) {
+  lval* m = lval_alloc();
+  m->type = LVAL_MEMO;
+  m->refs = 1;
+  m->memo = lmemo_new(lval_copy(fn), capacity);
+
+  return m;
+}
+
+// a promise to evaluate the s-expression expr in env, takes over expr
+lval* lval_lazy(lenv* env, lval* expr) {
+  lval* p = lval_alloc();
+  p->type = LVAL_LAZY;
+  p->refs = 1;
+  p->promised = expr;
+  p->scope = lenv_copy(env);
+
+  return p;
+}
+
+// the lazy sequence of first followed by what the promise rest gives,
+// takes over both
+lval* lval_seq(lval* first, lval* rest) {
+  lval* s = lval_alloc();
+  s->type = LVAL_SEQ;
+  s->refs = 1;
+  s->first = first;
+  s->rest = rest;
+
+  return s;
+}
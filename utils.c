@@ -2,22 +2,145 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <math.h>
 
 #include "mpc.h"
 #include "lispy.h"
 #include "lib.h"
 
-void lval_print(lval* v) {
+// lists part way through being printed, so deeply nested ones don't recurse
+typedef struct {
+  lval* v;
+  int next;
+  char open;
+  char close;
+} lprint_frame;
+
+static lprint_frame* frames = NULL;
+static int frames_count = 0;
+static int frames_cap = 0;
+
+static void lval_print_push(lval* v, char open, char close) {
+  if (frames_count == frames_cap) {
+    frames_cap = frames_cap ? frames_cap * 2 : 64;
+    frames = lmem_realloc(frames, sizeof(lprint_frame) * frames_cap);
+  }
+  lprint_frame* f = &frames[frames_count++];
+  f->v = v;
+  f->next = 0;
+  f->open = open;
+  f->close = close;
+}
+
+static void lval_print_seq(lval* v);
+
+// the fewest digits which read back as the same float, with a point so
+// it reads back as a float at all
+static void lval_print_dbl(double x) {
+  char buf[32];
+  for (int digits = 1; digits <= 17; digits++) {
+    snprintf(buf, sizeof(buf), "%.*g", digits, x);
+    if (strtod(buf, NULL) == x) { break; }
+  }
+
+  // %g goes to an exponent as soon as it runs out of digits, 1000.0
+  // would come out as 1e+03, so whole places get a digit each
+  if (strchr(buf, 'e') && fabs(x) >= 1 && fabs(x) < 1e17) {
+    snprintf(buf, sizeof(buf), "%.*g", (int)log10(fabs(x)) + 1, x);
+  }
+
+  // inf and nan have no digits to speak of
+  if (!strpbrk(buf, ".ein")) { strcat(buf, ".0"); }
+  printf("%s", buf);
+}
+
+static void lval_print_vec(lval* v) {
+  putchar('[');
+  for (long i = 0; i < v->vec_count; i++) {
+    if (i) { putchar(' '); }
+    if (v->vec_float) {
+      lval_print_dbl(v->vec_dbls[i]);
+    } else {
+      printf("%li", v->vec_ints[i]);
+    }
+  }
+  putchar(']');
+}
+
+// the maps being printed, innermost first, so one which holds itself
+// shows up as #{...} rather than going on forever
+typedef struct lprint_map {
+  lmap* map;
+  struct lprint_map* outer;
+} lprint_map;
+
+static lprint_map* printing_maps = NULL;
+
+// #{key value ...}, which reads back as (map-of {key value ...})
+static void lval_print_map(lval* v) {
+  for (lprint_map* p = printing_maps; p; p = p->outer) {
+    if (p->map == v->map) {
+      printf("#{...}");
+      return;
+    }
+  }
+  lprint_map self = { v->map, printing_maps };
+  printing_maps = &self;
+
+  printf("#{");
+  lval* key;
+  lval* value;
+  int first = 1;
+  for (int i = lmap_next(v->map, -1, &key, &value); i != -1;
+       i = lmap_next(v->map, i, &key, &value)) {
+    if (!first) { putchar(' '); }
+    first = 0;
+    lval_print(key);
+    putchar(' ');
+    lval_print(value);
+  }
+  putchar('}');
+
+  printing_maps = self.outer;
+}
+
+// prints v, lists are pushed and carried on with by lval_print_frames
+static void lval_print_one(lval* v) {
   switch (v->type) {
     case LVAL_FUN:
       if (v->builtin) {
         printf("<core-function>");
       } else {
         printf("<user-function>");
-        lval_print(v->formals);
-        lval_print(v->body);
+        // both lists, so both pushed, last in first out
+        lval_print_one(v->body);
+        lval_print_one(v->formals);
+      }
+      break;
+    case LVAL_PARTIAL: {
+      // the same as the function it's waiting to call, less what it has
+      lval* fn = v->applied;
+      printf("<user-function>{");
+      for (int i = v->bound->count; i < fn->formals->count; i++) {
+        printf(i > v->bound->count ? " %s" : "%s", fn->formals->cell[i]->sym);
       }
+      printf("}");
+      lval_print_one(fn->body);
       break;
+    }
+    case LVAL_MEMO:
+      printf("<memo-function>");
+      break;
+    case LVAL_LAZY:
+      if (v->scope) {
+        printf("<promise>");
+      } else {
+        printf("<promise ");
+        lval_print(v->promised);
+        printf(">");
+      }
+      break;
+    case LVAL_SEQ: lval_print_seq(v); break;
     case LVAL_BOOL:
       if (v->boolean == 0) {
         printf("false");
@@ -26,12 +149,89 @@ void lval_print(lval* v) {
       }
       break;
     case LVAL_NUM: printf("%li", v->num); break;
+    case LVAL_DBL: lval_print_dbl(v->dbl); break;
+    case LVAL_VEC: lval_print_vec(v); break;
+    case LVAL_MAP: lval_print_map(v); break;
+    case LVAL_BIG: {
+      char* digits = lbig_str(v);
+      printf("%s", digits);
+      lmem_free(digits);
+      break;
+    }
     case LVAL_SYM: printf("%s", v->sym); break;
     case LVAL_STR: lval_print_str(v); break;
     case LVAL_ERR: printf("%s", v->err); break;
-    case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-    case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+    case LVAL_SEXPR: lval_print_push(v, '(', ')'); break;
+    case LVAL_QEXPR: lval_print_push(v, '{', '}'); break;
+  }
+}
+
+// prints whatever has been pushed since base
+static void lval_print_frames(int base) {
+  while (frames_count > base) {
+    lprint_frame* f = &frames[frames_count - 1];
+    lval* v = f->v;
+
+    if (f->next == 0) { putchar(f->open); }
+    if (f->next == v->count) {
+      putchar(f->close);
+      frames_count--;
+      continue;
+    }
+
+    // give some breathing room to all except the last element as printing
+    if (f->next > 0) { putchar(' '); }
+    lval_print_one(v->cell[f->next++]);
+  }
+}
+
+// what follows the first item of v, NULL when it's yet to be forced
+static lval* lval_seq_forced(lval* v) {
+  lval* rest = v->rest;
+  if (rest->type == LVAL_LAZY) {
+    return rest->scope ? NULL : rest->promised;
   }
+  return rest;
+}
+
+// prints as much of a lazy sequence as has been worked out, without
+// forcing any more, ... standing for the rest, a sequence which comes back
+// round to itself is caught by a second walk along it at half the pace
+static void lval_print_seq(lval* v) {
+  lval* slow = v;
+  int steps = 0;
+
+  putchar('{');
+  lval_print(v->first);
+
+  for (;;) {
+    lval* rest = lval_seq_forced(v);
+    if (!rest) { break; }
+
+    if (rest->type == LVAL_QEXPR) {
+      for (int i = 0; i < rest->count; i++) {
+        putchar(' ');
+        lval_print(rest->cell[i]);
+      }
+      putchar('}');
+      return;
+    }
+    if (rest->type != LVAL_SEQ) { break; }
+
+    v = rest;
+    if (++steps % 2 == 0) { slow = lval_seq_forced(slow); }
+    if (v == slow) { break; }
+
+    putchar(' ');
+    lval_print(v->first);
+  }
+  printf(" ...}");
+}
+
+void lval_print(lval* v) {
+  int base = frames_count;
+  lval_print_one(v);
+  lval_print_frames(base);
 }
 
 void lval_println(lval* v) {
@@ -40,29 +240,30 @@ void lval_println(lval* v) {
 }
 
 void lval_expr_print(lval* v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    lval_print(v->cell[i]);
-
-    // give some breathing room to all except the last element as printing
-    if (i != (v->count - 1)) {
-      putchar(' ');
-    }
-  }
-  putchar(close);
+  int base = frames_count;
+  lval_print_push(v, open, close);
+  lval_print_frames(base);
 }
 
 // we're just mapping enums to a label
 char* lval_human_name(int t) {
   switch(t) {
-    case LVAL_FUN: return "function";
-    case LVAL_NUM: return "number";
+    case LVAL_FUN:
+    case LVAL_PARTIAL:
+    case LVAL_MEMO: return "function";
+    case LVAL_NUM:
+    case LVAL_BIG: return "number";
+    case LVAL_DBL: return "float";
     case LVAL_BOOL: return "boolean";
     case LVAL_ERR: return "error";
     case LVAL_SYM: return "symbol";
     case LVAL_STR: return "string";
     case LVAL_SEXPR: return "symbolic expression";
     case LVAL_QEXPR: return "quoted expression";
+    case LVAL_LAZY: return "promise";
+    case LVAL_SEQ: return "lazy sequence";
+    case LVAL_VEC: return "vector";
+    case LVAL_MAP: return "map";
     default: return "Unknown";
   }
 }
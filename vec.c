@@ -0,0 +1,667 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define LVEC_X86 1
+#endif
+
+//
+//
+// VECTORS
+//
+//
+
+// a vector is a run of machine integers or floats side by side, rather
+// than a list of values each in a cell of its own, written [1 2 3]
+
+// arithmetic, min, max and the comparisons work on them element by
+// element, a number or float among the operands standing for one of the
+// same length, so (* [1 2 3] 2) is [2 4 6], integers which would overflow
+// are an error rather than becoming big numbers, as there is no room for
+// one in a vector, and floats which wouldn't be finite are an error as
+// they are anywhere else
+
+// the loops over the elements are kernels, picked when first needed from
+// those the cpu can run, see lvec_best, each as good as the scalar one
+// but with the bulk of the work done 2 or 4 elements at a time
+
+// why the arithmetic ones have no result, when they don't, overflowing
+// being going out of range for floats
+enum { LVEC_OK, LVEC_DIV_ZERO, LVEC_OVERFLOW };
+
+// which the loops are given for x and y, each of which is a whole vector,
+// step 1, or a single element repeated, step 0
+typedef struct lvec_kernels {
+  char* name;
+  // out = x op y, or why not
+  int  (*dbl_arith)(int op, double* out, double* x, int xs, double* y, int ys, long n);
+  // 1 in out where x op y holds, otherwise 0
+  void (*dbl_compare)(int op, long* out, double* x, int xs, double* y, int ys, long n);
+  int  (*int_arith)(int op, long* out, long* x, int xs, long* y, int ys, long n);
+  void (*int_compare)(int op, long* out, long* x, int xs, long* y, int ys, long n);
+} lvec_kernels;
+
+//
+// scalar
+//
+
+// a single element of x op y, min and max as builtin_min and builtin_max
+// would pick them, an operand standing for a number too big for a float
+// can still be inf
+static int lvec_dbl_one(int op, double x, double y, double* out) {
+  switch (op) {
+    case LB_MIN: *out = y < x ? y : x; return isfinite(*out) ? LVEC_OK : LVEC_OVERFLOW;
+    case LB_MAX: *out = x < y ? y : x; return isfinite(*out) ? LVEC_OK : LVEC_OVERFLOW;
+  }
+  if (lnum_arith_dbl(op, x, y, out)) { return LVEC_OK; }
+  return lnum_div_zero(op, x, y) ? LVEC_DIV_ZERO : LVEC_OVERFLOW;
+}
+
+static int lvec_int_one(int op, long x, long y, long* out) {
+  switch (op) {
+    case LB_MIN: *out = y < x ? y : x; return LVEC_OK;
+    case LB_MAX: *out = x < y ? y : x; return LVEC_OK;
+  }
+  if (lnum_arith(op, x, y, out)) { return LVEC_OK; }
+  return lnum_div_zero(op, x, y) ? LVEC_DIV_ZERO : LVEC_OVERFLOW;
+}
+
+// the elements from i on, which the wider kernels leave for after their
+// last full register
+static int lvec_dbl_arith_from(long i, int op, double* out, double* x, int xs,
+                               double* y, int ys, long n) {
+  for (; i < n; i++) {
+    int why = lvec_dbl_one(op, x[i * xs], y[i * ys], &out[i]);
+    if (why != LVEC_OK) { return why; }
+  }
+  return LVEC_OK;
+}
+
+static void lvec_dbl_compare_from(long i, int op, long* out, double* x, int xs,
+                                  double* y, int ys, long n) {
+  for (; i < n; i++) { out[i] = lnum_compare_dbl(op, x[i * xs], y[i * ys]); }
+}
+
+static int lvec_int_arith_from(long i, int op, long* out, long* x, int xs,
+                               long* y, int ys, long n) {
+  for (; i < n; i++) {
+    int why = lvec_int_one(op, x[i * xs], y[i * ys], &out[i]);
+    if (why != LVEC_OK) { return why; }
+  }
+  return LVEC_OK;
+}
+
+static void lvec_int_compare_from(long i, int op, long* out, long* x, int xs,
+                                  long* y, int ys, long n) {
+  for (; i < n; i++) { out[i] = lnum_compare(op, x[i * xs], y[i * ys]); }
+}
+
+static int lvec_dbl_arith_scalar(int op, double* out, double* x, int xs,
+                                 double* y, int ys, long n) {
+  return lvec_dbl_arith_from(0, op, out, x, xs, y, ys, n);
+}
+
+static void lvec_dbl_compare_scalar(int op, long* out, double* x, int xs,
+                                    double* y, int ys, long n) {
+  lvec_dbl_compare_from(0, op, out, x, xs, y, ys, n);
+}
+
+static int lvec_int_arith_scalar(int op, long* out, long* x, int xs,
+                                 long* y, int ys, long n) {
+  return lvec_int_arith_from(0, op, out, x, xs, y, ys, n);
+}
+
+static void lvec_int_compare_scalar(int op, long* out, long* x, int xs,
+                                    long* y, int ys, long n) {
+  lvec_int_compare_from(0, op, out, x, xs, y, ys, n);
+}
+
+static lvec_kernels lvec_scalar = {
+  "scalar",
+  lvec_dbl_arith_scalar, lvec_dbl_compare_scalar,
+  lvec_int_arith_scalar, lvec_int_compare_scalar
+};
+
+#ifdef LVEC_X86
+
+//
+// sse2, which every x86-64 has, 2 elements at a time
+//
+
+// a and b the next of x and y, what expr gives stored in out, check is
+// run on each pair before it, r - r is nan where r isn't finite
+#define LVEC_SSE2_PD(expr, check) \
+  for (; i + 2 <= n; i += 2) { \
+    __m128d a = xs ? _mm_loadu_pd(x + i) : xb; \
+    __m128d b = ys ? _mm_loadu_pd(y + i) : yb; \
+    check; \
+    __m128d r = expr; \
+    bad = _mm_or_pd(bad, _mm_cmpunord_pd(_mm_sub_pd(r, r), zero)); \
+    _mm_storeu_pd(out + i, r); \
+  }
+
+static int lvec_dbl_arith_sse2(int op, double* out, double* x, int xs,
+                               double* y, int ys, long n) {
+  __m128d xb = _mm_set1_pd(x[0]), yb = _mm_set1_pd(y[0]);
+  __m128d zero = _mm_setzero_pd(), zeros = zero, bad = zero;
+  long i = 0;
+
+  switch (op) {
+    case LB_ADD: LVEC_SSE2_PD(_mm_add_pd(a, b), ); break;
+    case LB_SUB: LVEC_SSE2_PD(_mm_sub_pd(a, b), ); break;
+    case LB_MUL: LVEC_SSE2_PD(_mm_mul_pd(a, b), ); break;
+    case LB_DIV:
+      LVEC_SSE2_PD(_mm_div_pd(a, b), zeros = _mm_or_pd(zeros, _mm_cmpeq_pd(b, zero)));
+      break;
+    case LB_MIN: LVEC_SSE2_PD(_mm_min_pd(b, a), ); break;
+    case LB_MAX: LVEC_SSE2_PD(_mm_max_pd(b, a), ); break;
+  }
+  if (_mm_movemask_pd(zeros)) { return LVEC_DIV_ZERO; }
+  if (_mm_movemask_pd(bad)) { return LVEC_OVERFLOW; }
+  return lvec_dbl_arith_from(i, op, out, x, xs, y, ys, n);
+}
+
+// the comparison's mask, all ones or all zeros, down to 1 or 0
+#define LVEC_SSE2_CMP_PD(cmp) \
+  for (; i + 2 <= n; i += 2) { \
+    __m128d a = xs ? _mm_loadu_pd(x + i) : xb; \
+    __m128d b = ys ? _mm_loadu_pd(y + i) : yb; \
+    __m128i m = _mm_and_si128(_mm_castpd_si128(cmp(a, b)), one); \
+    _mm_storeu_si128((__m128i*)(out + i), m); \
+  }
+
+static void lvec_dbl_compare_sse2(int op, long* out, double* x, int xs,
+                                  double* y, int ys, long n) {
+  __m128d xb = _mm_set1_pd(x[0]), yb = _mm_set1_pd(y[0]);
+  __m128i one = _mm_set1_epi64x(1);
+  long i = 0;
+
+  switch (op) {
+    case LB_GT:  LVEC_SSE2_CMP_PD(_mm_cmpgt_pd); break;
+    case LB_LT:  LVEC_SSE2_CMP_PD(_mm_cmplt_pd); break;
+    case LB_GTE: LVEC_SSE2_CMP_PD(_mm_cmpge_pd); break;
+    case LB_LTE: LVEC_SSE2_CMP_PD(_mm_cmple_pd); break;
+    case LB_EQ:  LVEC_SSE2_CMP_PD(_mm_cmpeq_pd); break;
+    case LB_NEQ: LVEC_SSE2_CMP_PD(_mm_cmpneq_pd); break;
+  }
+  lvec_dbl_compare_from(i, op, out, x, xs, y, ys, n);
+}
+
+// sse2 has no 64 bit comparisons or multiply, so only + and - are done
+// here, a sum has overflowed where its sign differs from both operands',
+// a difference where the operands' signs differ and the result's isn't x's
+#define LVEC_SSE2_EPI64(expr, overflowed) \
+  for (; i + 2 <= n; i += 2) { \
+    __m128i a = xs ? _mm_loadu_si128((__m128i*)(x + i)) : xb; \
+    __m128i b = ys ? _mm_loadu_si128((__m128i*)(y + i)) : yb; \
+    __m128i r = expr; \
+    over = _mm_or_si128(over, overflowed); \
+    _mm_storeu_si128((__m128i*)(out + i), r); \
+  }
+
+static int lvec_int_arith_sse2(int op, long* out, long* x, int xs,
+                               long* y, int ys, long n) {
+  __m128i xb = _mm_set1_epi64x(x[0]), yb = _mm_set1_epi64x(y[0]);
+  __m128i over = _mm_setzero_si128();
+  long i = 0;
+
+  switch (op) {
+    case LB_ADD:
+      LVEC_SSE2_EPI64(_mm_add_epi64(a, b),
+        _mm_and_si128(_mm_xor_si128(a, r), _mm_xor_si128(b, r)));
+      break;
+    case LB_SUB:
+      LVEC_SSE2_EPI64(_mm_sub_epi64(a, b),
+        _mm_and_si128(_mm_xor_si128(a, b), _mm_xor_si128(a, r)));
+      break;
+  }
+  if (_mm_movemask_pd(_mm_castsi128_pd(over))) { return LVEC_OVERFLOW; }
+  return lvec_int_arith_from(i, op, out, x, xs, y, ys, n);
+}
+
+static lvec_kernels lvec_sse2 = {
+  "sse2",
+  lvec_dbl_arith_sse2, lvec_dbl_compare_sse2,
+  lvec_int_arith_sse2, lvec_int_compare_scalar
+};
+
+//
+// avx2, 4 elements at a time, compiled for it whatever the rest is
+// compiled for, and only ever called when the cpu says it has it
+//
+
+#define LVEC_AVX2 __attribute__((target("avx2")))
+
+#define LVEC_AVX2_PD(expr, check) \
+  for (; i + 4 <= n; i += 4) { \
+    __m256d a = xs ? _mm256_loadu_pd(x + i) : xb; \
+    __m256d b = ys ? _mm256_loadu_pd(y + i) : yb; \
+    check; \
+    __m256d r = expr; \
+    bad = _mm256_or_pd(bad, _mm256_cmp_pd(_mm256_sub_pd(r, r), zero, _CMP_UNORD_Q)); \
+    _mm256_storeu_pd(out + i, r); \
+  }
+
+LVEC_AVX2
+static int lvec_dbl_arith_avx2(int op, double* out, double* x, int xs,
+                               double* y, int ys, long n) {
+  __m256d xb = _mm256_set1_pd(x[0]), yb = _mm256_set1_pd(y[0]);
+  __m256d zero = _mm256_setzero_pd(), zeros = zero, bad = zero;
+  long i = 0;
+
+  switch (op) {
+    case LB_ADD: LVEC_AVX2_PD(_mm256_add_pd(a, b), ); break;
+    case LB_SUB: LVEC_AVX2_PD(_mm256_sub_pd(a, b), ); break;
+    case LB_MUL: LVEC_AVX2_PD(_mm256_mul_pd(a, b), ); break;
+    case LB_DIV:
+      LVEC_AVX2_PD(_mm256_div_pd(a, b),
+        zeros = _mm256_or_pd(zeros, _mm256_cmp_pd(b, zero, _CMP_EQ_OQ)));
+      break;
+    case LB_MIN: LVEC_AVX2_PD(_mm256_min_pd(b, a), ); break;
+    case LB_MAX: LVEC_AVX2_PD(_mm256_max_pd(b, a), ); break;
+  }
+  if (_mm256_movemask_pd(zeros)) { return LVEC_DIV_ZERO; }
+  if (_mm256_movemask_pd(bad)) { return LVEC_OVERFLOW; }
+  return lvec_dbl_arith_from(i, op, out, x, xs, y, ys, n);
+}
+
+#define LVEC_AVX2_CMP_PD(pred) \
+  for (; i + 4 <= n; i += 4) { \
+    __m256d a = xs ? _mm256_loadu_pd(x + i) : xb; \
+    __m256d b = ys ? _mm256_loadu_pd(y + i) : yb; \
+    __m256i m = _mm256_castpd_si256(_mm256_cmp_pd(a, b, pred)); \
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_and_si256(m, one)); \
+  }
+
+LVEC_AVX2
+static void lvec_dbl_compare_avx2(int op, long* out, double* x, int xs,
+                                  double* y, int ys, long n) {
+  __m256d xb = _mm256_set1_pd(x[0]), yb = _mm256_set1_pd(y[0]);
+  __m256i one = _mm256_set1_epi64x(1);
+  long i = 0;
+
+  // ordered, so false where there's a nan, except != as in C
+  switch (op) {
+    case LB_GT:  LVEC_AVX2_CMP_PD(_CMP_GT_OQ); break;
+    case LB_LT:  LVEC_AVX2_CMP_PD(_CMP_LT_OQ); break;
+    case LB_GTE: LVEC_AVX2_CMP_PD(_CMP_GE_OQ); break;
+    case LB_LTE: LVEC_AVX2_CMP_PD(_CMP_LE_OQ); break;
+    case LB_EQ:  LVEC_AVX2_CMP_PD(_CMP_EQ_OQ); break;
+    case LB_NEQ: LVEC_AVX2_CMP_PD(_CMP_NEQ_UQ); break;
+  }
+  lvec_dbl_compare_from(i, op, out, x, xs, y, ys, n);
+}
+
+#define LVEC_AVX2_EPI64(expr, overflowed) \
+  for (; i + 4 <= n; i += 4) { \
+    __m256i a = xs ? _mm256_loadu_si256((__m256i*)(x + i)) : xb; \
+    __m256i b = ys ? _mm256_loadu_si256((__m256i*)(y + i)) : yb; \
+    __m256i r = expr; \
+    over = _mm256_or_si256(over, overflowed); \
+    _mm256_storeu_si256((__m256i*)(out + i), r); \
+  }
+
+// there's still no 64 bit multiply, but there are comparisons, so min
+// and max are done here too
+LVEC_AVX2
+static int lvec_int_arith_avx2(int op, long* out, long* x, int xs,
+                               long* y, int ys, long n) {
+  __m256i xb = _mm256_set1_epi64x(x[0]), yb = _mm256_set1_epi64x(y[0]);
+  __m256i none = _mm256_setzero_si256(), over = none;
+  long i = 0;
+
+  switch (op) {
+    case LB_ADD:
+      LVEC_AVX2_EPI64(_mm256_add_epi64(a, b),
+        _mm256_and_si256(_mm256_xor_si256(a, r), _mm256_xor_si256(b, r)));
+      break;
+    case LB_SUB:
+      LVEC_AVX2_EPI64(_mm256_sub_epi64(a, b),
+        _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, r)));
+      break;
+    case LB_MIN:
+      LVEC_AVX2_EPI64(_mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)), none);
+      break;
+    case LB_MAX:
+      LVEC_AVX2_EPI64(_mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a)), none);
+      break;
+  }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(over))) { return LVEC_OVERFLOW; }
+  return lvec_int_arith_from(i, op, out, x, xs, y, ys, n);
+}
+
+#define LVEC_AVX2_CMP_EPI64(expr) \
+  for (; i + 4 <= n; i += 4) { \
+    __m256i a = xs ? _mm256_loadu_si256((__m256i*)(x + i)) : xb; \
+    __m256i b = ys ? _mm256_loadu_si256((__m256i*)(y + i)) : yb; \
+    _mm256_storeu_si256((__m256i*)(out + i), expr); \
+  }
+
+LVEC_AVX2
+static void lvec_int_compare_avx2(int op, long* out, long* x, int xs,
+                                  long* y, int ys, long n) {
+  __m256i xb = _mm256_set1_epi64x(x[0]), yb = _mm256_set1_epi64x(y[0]);
+  __m256i one = _mm256_set1_epi64x(1);
+  long i = 0;
+
+  // only > and == to go on, the rest are those or the opposite of them
+  switch (op) {
+    case LB_GT:  LVEC_AVX2_CMP_EPI64(_mm256_and_si256(_mm256_cmpgt_epi64(a, b), one)); break;
+    case LB_LT:  LVEC_AVX2_CMP_EPI64(_mm256_and_si256(_mm256_cmpgt_epi64(b, a), one)); break;
+    case LB_GTE: LVEC_AVX2_CMP_EPI64(_mm256_andnot_si256(_mm256_cmpgt_epi64(b, a), one)); break;
+    case LB_LTE: LVEC_AVX2_CMP_EPI64(_mm256_andnot_si256(_mm256_cmpgt_epi64(a, b), one)); break;
+    case LB_EQ:  LVEC_AVX2_CMP_EPI64(_mm256_and_si256(_mm256_cmpeq_epi64(a, b), one)); break;
+    case LB_NEQ: LVEC_AVX2_CMP_EPI64(_mm256_andnot_si256(_mm256_cmpeq_epi64(a, b), one)); break;
+  }
+  lvec_int_compare_from(i, op, out, x, xs, y, ys, n);
+}
+
+static lvec_kernels lvec_avx2 = {
+  "avx2",
+  lvec_dbl_arith_avx2, lvec_dbl_compare_avx2,
+  lvec_int_arith_avx2, lvec_int_compare_avx2
+};
+
+#endif
+
+static lvec_kernels* kernels = NULL;
+
+// the widest kernels this cpu runs
+static lvec_kernels* lvec_best(void) {
+#ifdef LVEC_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) { return &lvec_avx2; }
+  return &lvec_sse2;
+#else
+  return &lvec_scalar;
+#endif
+}
+
+// uses the kernels called name, "auto" for the best there are, gives 0
+// when there are no such kernels, or the cpu can't run them
+int lvec_use(char* name) {
+  lvec_kernels* k = NULL;
+  if (strcmp(name, "auto") == 0) { k = lvec_best(); }
+  if (strcmp(name, "scalar") == 0) { k = &lvec_scalar; }
+#ifdef LVEC_X86
+  if (strcmp(name, "sse2") == 0) { k = &lvec_sse2; }
+  if (strcmp(name, "avx2") == 0 && lvec_best() == &lvec_avx2) { k = &lvec_avx2; }
+#endif
+  if (!k) { return 0; }
+
+  kernels = k;
+  return 1;
+}
+
+char* lvec_kernels_name(void) {
+  if (!kernels) { kernels = lvec_best(); }
+  return kernels->name;
+}
+
+//
+// operations
+//
+
+int lvec_any(lval** args, int n) {
+  for (int i = 0; i < n; i++) {
+    if (args[i]->type == LVAL_VEC) { return 1; }
+  }
+  return 0;
+}
+
+static char* lvec_op_name(int op) {
+  switch (op) {
+    case LB_ADD: return "+";
+    case LB_SUB: return "-";
+    case LB_MUL: return "*";
+    case LB_DIV: return "/";
+    case LB_MOD: return "%";
+    case LB_POW: return "^";
+    case LB_GT:  return ">";
+    case LB_LT:  return "<";
+    case LB_GTE: return ">=";
+    case LB_LTE: return "<=";
+    case LB_EQ:  return "==";
+    case LB_NEQ: return "!=";
+    case LB_MIN: return "min";
+    case LB_MAX: return "max";
+  }
+  return "?";
+}
+
+// how long the vectors among the n operands all are, or -1 and err set
+// when they don't agree or one of the operands can't go in a vector
+static long lvec_length(lval** args, int n, int op, int* floats, lval** err) {
+  char* name = lvec_op_name(op);
+  long length = -1;
+  *floats = 0;
+  for (int i = 0; i < n; i++) {
+    lval* v = args[i];
+    if (v->type == LVAL_BIG) {
+      *err = lval_err("Function '%s', passed a number too big for a vector "
+                      "at argument index %i", name, i);
+      return -1;
+    }
+    if (v->type == LVAL_DBL) { *floats = 1; }
+    if (v->type != LVAL_VEC) { continue; }
+
+    if (v->vec_float) { *floats = 1; }
+    if (length != -1 && v->vec_count != length) {
+      *err = lval_err("Function '%s', passed vectors of length %li and %li",
+                      name, length, v->vec_count);
+      return -1;
+    }
+    length = v->vec_count;
+  }
+  return length;
+}
+
+// v as floats, with step 1 when it's a vector, otherwise 0, gives the
+// elements if they had to be worked out, for the caller to free
+static double* lvec_dbls(lval* v, double* one, int* step) {
+  *step = v->type == LVAL_VEC;
+  if (v->type != LVAL_VEC) {
+    *one = lnum_dbl(v);
+    return NULL;
+  }
+  if (v->vec_float) { return NULL; }
+
+  double* d = lmem_alloc(sizeof(double) * (v->vec_count ? v->vec_count : 1));
+  for (long i = 0; i < v->vec_count; i++) { d[i] = (double)v->vec_ints[i]; }
+  return d;
+}
+
+static double* lvec_dbls_of(lval* v, double* one, double* made) {
+  if (v->type != LVAL_VEC) { return one; }
+  return made ? made : v->vec_dbls;
+}
+
+// a vector of n to write the result in, one of x and y if nothing else
+// holds it and it has the right elements, as with lnum_dbl_into, never a
+// window, whose elements belong to another vector
+static lval* lvec_into(lval* x, lval* y, int floats, long n) {
+  lval* both[2] = { x, y };
+  for (int i = 0; i < 2; i++) {
+    lval* v = both[i];
+    if (v->type == LVAL_VEC && v->refs == 1 && v->vec_float == floats &&
+        !v->vec_backing) {
+      return lval_copy(v);
+    }
+  }
+  return lval_vec(floats, n);
+}
+
+// x op y where one of them is a vector of n, op an arithmetic one, or
+// a comparison, doesn't take over x or y
+static lval* lvec_binary(int op, lval* x, lval* y, long n, int floats) {
+  int compare = op >= LB_GT && op <= LB_NEQ;
+  int why = LVEC_OK;
+  lval* out;
+
+  if (floats) {
+    double xone, yone;
+    int xs, ys;
+    double* xmade = lvec_dbls(x, &xone, &xs);
+    double* ymade = lvec_dbls(y, &yone, &ys);
+    double* xd = lvec_dbls_of(x, &xone, xmade);
+    double* yd = lvec_dbls_of(y, &yone, ymade);
+
+    if (compare) {
+      out = lvec_into(x, y, 0, n);
+      kernels->dbl_compare(op, out->vec_ints, xd, xs, yd, ys, n);
+    } else {
+      out = lvec_into(x, y, 1, n);
+      why = kernels->dbl_arith(op, out->vec_dbls, xd, xs, yd, ys, n);
+    }
+    lmem_free(xmade);
+    lmem_free(ymade);
+  } else {
+    long xone = x->type == LVAL_VEC ? 0 : x->num;
+    long yone = y->type == LVAL_VEC ? 0 : y->num;
+    long* xd = x->type == LVAL_VEC ? x->vec_ints : &xone;
+    long* yd = y->type == LVAL_VEC ? y->vec_ints : &yone;
+    int xs = x->type == LVAL_VEC, ys = y->type == LVAL_VEC;
+
+    out = lvec_into(x, y, 0, n);
+    if (compare) {
+      kernels->int_compare(op, out->vec_ints, xd, xs, yd, ys, n);
+    } else {
+      why = kernels->int_arith(op, out->vec_ints, xd, xs, yd, ys, n);
+    }
+  }
+
+  if (why == LVEC_OK) { return out; }
+  lval_del(out);
+  if (why == LVEC_DIV_ZERO) { return lval_err("Division by Zero!"); }
+  if (floats) { return lval_err("Float result out of range!"); }
+  return lval_err("Integer overflow in vector arithmetic!");
+}
+
+// builtin_op, builtin_min and builtin_max, once one of the operands is a
+// vector, takes over a
+lval* lvec_op(lval* a, int op) {
+  if (!kernels) { kernels = lvec_best(); }
+
+  int floats;
+  lval* err = NULL;
+  long n = lvec_length(a->cell, a->count, op, &floats, &err);
+  if (err) {
+    lval_del(a);
+    return err;
+  }
+
+  lval* x;
+  if (op == LB_SUB && a->count == 1) {
+    lval* zero = lval_num(0);
+    x = lvec_binary(op, zero, a->cell[0], n, floats);
+    lval_del(zero);
+  } else {
+    x = lval_copy(a->cell[0]);
+  }
+
+  for (int i = 1; i < a->count && x->type != LVAL_ERR; i++) {
+    lval* y = lvec_binary(op, x, a->cell[i], n, floats);
+    lval_del(x);
+    x = y;
+  }
+
+  lval_del(a);
+  return x;
+}
+
+// builtin_compare, once one of the two is a vector, a vector of 1 where
+// the comparison holds and 0 where it doesn't
+lval* lvec_compare(lval* a, int op) {
+  if (!kernels) { kernels = lvec_best(); }
+
+  int floats;
+  lval* err = NULL;
+  long n = lvec_length(a->cell, 2, op, &floats, &err);
+  if (!err) { err = lvec_binary(op, a->cell[0], a->cell[1], n, floats); }
+
+  lval_del(a);
+  return err;
+}
+
+//
+// making and taking apart
+//
+
+// the numbers and floats in list as a vector, which has floats if any of
+// them is one, takes over list
+lval* lvec_of_list(lval* list) {
+  int floats = 0;
+  for (int i = 0; i < list->count; i++) {
+    int t = list->cell[i]->type;
+    if (t == LVAL_DBL) { floats = 1; continue; }
+    if (t == LVAL_NUM) { continue; }
+
+    lval* err = t == LVAL_ERR ? lval_copy(list->cell[i])
+      : lval_err("A vector can only hold numbers and floats, "
+                 "not a %s at index %i",
+                 t == LVAL_BIG ? "number that big" : lval_human_name(t), i);
+    lval_del(list);
+    return err;
+  }
+
+  lval* v = lval_vec(floats, list->count);
+  for (int i = 0; i < list->count; i++) {
+    if (floats) {
+      v->vec_dbls[i] = lnum_dbl(list->cell[i]);
+    } else {
+      v->vec_ints[i] = list->cell[i]->num;
+    }
+  }
+  lval_del(list);
+  return v;
+}
+
+// element i of v as a number or float
+lval* lvec_nth(lval* v, long i) {
+  return v->vec_float ? lval_dbl(v->vec_dbls[i]) : lval_num(v->vec_ints[i]);
+}
+
+// v's elements as a q-expression
+lval* lvec_to_list(lval* v) {
+  lval* list = lval_qexpr();
+  lval_reserve(list, v->vec_count);
+  for (long i = 0; i < v->vec_count; i++) {
+    lval_add(list, lvec_nth(v, i));
+  }
+  return list;
+}
+
+// count elements of v from start, which has to be within it, as a window
+// onto v's elements rather than a copy, so walking a vector with tail is
+// linear, the same as lists, see lval_slice, doesn't take over v
+lval* lvec_slice(lval* v, long start, long count) {
+  lval* s = lval_alloc();
+  s->type = LVAL_VEC;
+  s->refs = 1;
+  s->vec_count = count;
+  s->vec_float = v->vec_float;
+  if (v->vec_float) {
+    s->vec_dbls = v->vec_dbls + start;
+  } else {
+    s->vec_ints = v->vec_ints + start;
+  }
+
+  // windows onto windows look straight into the underlying vector
+  s->vec_backing = lval_copy(v->vec_backing ? v->vec_backing : v);
+  return s;
+}
+
+// 0 to n - 1
+lval* lvec_range(long n) {
+  lval* v = lval_vec(0, n);
+  for (long i = 0; i < n; i++) { v->vec_ints[i] = i; }
+  return v;
+}
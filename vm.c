@@ -0,0 +1,1288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mpc.h"
+#include "lispy.h"
+#include "lib.h"
+
+//
+//
+// BYTECODE
+//
+//
+
+// the tree walker in lvals.c looks at every node of an expression each
+// time it's evaluated, working out all over again whether it's a symbol
+// or a call, and building an argument list for every builtin
+
+// here a list is compiled once into instructions for a small stack
+// machine, and keeps them, so a function body is only compiled the first
+// time it's called
+
+// symbols like '+' or 'if' can be redefined at any time, so those which
+// are compiled to their own instructions are still looked up as usual,
+// and when the instruction runs it checks it really has the builtin, and
+// otherwise just makes an ordinary call
+
+// special forms are handed their operands unevaluated, so any call might
+// turn out to be one, which is checked for once the function is known,
+// before the arguments are evaluated, see LOP_SPECIAL
+
+enum {
+  // push consts[a]
+  LOP_CONST,
+  // push the value of the symbol consts[a]
+  LOP_LOOKUP,
+  // the same for a symbol which isn't an argument, remembering what it
+  // found in caches[b]
+  LOP_GLOBAL,
+  // call the function under the a arguments on top of the stack
+  LOP_CALL,
+  // when the function on top of the stack is a special form, call it
+  // with the rest of the list consts[a] as it is and jump to b, past the
+  // code evaluating the arguments and calling it
+  LOP_SPECIAL,
+
+  // the same as LOP_CALL, but done here for numbers when the function
+  // is the builtin
+  LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD, LOP_POW,
+  LOP_GT, LOP_LT, LOP_GTE, LOP_LTE, LOP_EQ, LOP_NEQ,
+  LOP_HEAD, LOP_TAIL,
+
+  // with the special form itself on the stack, pops it and carries on
+  // with the code for it in place, and when it isn't after all jumps
+  // to a to call whatever it is instead
+  LOP_IF, LOP_AND, LOP_OR, LOP_DO,
+
+  LOP_JUMP,
+  // pop a value and jump to a when it's false, or true
+  LOP_JUMP_FALSE,
+  LOP_JUMP_TRUE,
+  // pop a value nothing needs
+  LOP_DROP,
+
+  // evaluate the list consts[a] in a frame of its own, for lists nested
+  // too deeply to compile in place, see lcode_compile_list
+  LOP_EVAL,
+
+  // while everything the code was folded with stays the same, push
+  // consts[a] and jump to b, otherwise carry on and work it out
+  LOP_FOLDED,
+  // once anything the code was folded with has changed, jump to a
+  LOP_STALE,
+
+  // done with this list, its value is on top of the stack
+  LOP_RETURN
+};
+
+// which builtin each instruction stands in for, and the symbol it has to
+// be called for to be compiled to it, in the same order as the instructions
+static struct {
+  int op;
+  char** sym;
+  int builtin;
+} inlined[] = {
+  { LOP_ADD,  &lsym_add,  LB_ADD },
+  { LOP_SUB,  &lsym_sub,  LB_SUB },
+  { LOP_MUL,  &lsym_mul,  LB_MUL },
+  { LOP_DIV,  &lsym_div,  LB_DIV },
+  { LOP_MOD,  &lsym_mod,  LB_MOD },
+  { LOP_POW,  &lsym_pow,  LB_POW },
+  { LOP_GT,   &lsym_gt,   LB_GT },
+  { LOP_LT,   &lsym_lt,   LB_LT },
+  { LOP_GTE,  &lsym_gte,  LB_GTE },
+  { LOP_LTE,  &lsym_lte,  LB_LTE },
+  { LOP_EQ,   &lsym_eq,   LB_EQ },
+  { LOP_NEQ,  &lsym_neq,  LB_NEQ },
+  { LOP_HEAD, &lsym_head, LB_HEAD },
+  { LOP_TAIL, &lsym_tail, LB_TAIL },
+  { LOP_IF,   &lsym_if,   LB_IF },
+  { LOP_AND,  &lsym_and,  LB_AND },
+  { LOP_OR,   &lsym_or,   LB_OR },
+  { LOP_DO,   &lsym_do,   LB_DO },
+};
+
+#define LOP_INLINED (int)(sizeof(inlined) / sizeof(inlined[0]))
+
+static int lop_builtin(int op) {
+  return inlined[op - LOP_ADD].builtin;
+}
+
+// whether fn really is the builtin the instruction stands in for
+static int lop_is(int op, lval* fn) {
+  return fn->type == LVAL_FUN && fn->builtin && fn->info->op == lop_builtin(op);
+}
+
+// what a global lookup found, for as long as no global has been defined
+// since, and so long as the name has never been bound anywhere else,
+// nothing can have come between, see lenv_version
+typedef struct lcache {
+  unsigned long version;
+  // borrowed, the global environment holds it until the version changes
+  lval* value;
+} lcache;
+
+typedef struct lcode {
+  // instructions, each followed by its operands
+  int* ops;
+  int count;
+  int cap;
+
+  // symbols and constants, borrowed from the list which was compiled,
+  // which holds on to them for as long as it has its code
+  lval** consts;
+  int consts_count;
+  int consts_cap;
+
+  // one per global lookup
+  lcache* caches;
+  int caches_count;
+  int caches_cap;
+
+  // values worked out as it was compiled, which it holds references to,
+  // and the symbols it took to be constants to do that, see lvm_fold
+  lval** owned;
+  int owned_count;
+  int owned_cap;
+  lval** folded;
+  int folded_count;
+  int folded_cap;
+  // when it was folded, it's stale once anything folded is redefined
+  int epoch;
+
+  // calls to the function it's the body of, and its native code once
+  // there have been LJIT_THRESHOLD, see lvm_jit
+  int calls;
+  ljit* jit;
+  // one more than the frame a call the native code went too deep in is
+  // running in, 0 when there isn't one, see lvm_jit
+  int too_deep;
+
+  // where it is in the code table
+  int index;
+  // how many frames are running it, when it's released while they are
+  // it's only freed once they're done
+  int running;
+  int released;
+} lcode;
+
+//
+// the code table, lists refer to their code by its index, 0 is never used
+//
+
+static lcode** codes = NULL;
+static int codes_count = 1;
+static int codes_cap = 0;
+
+// indexes given back, to be handed out again
+static int* unused = NULL;
+static int unused_count = 0;
+static int unused_cap = 0;
+
+static int lcode_new(void) {
+  lcode* c = lmem_alloc(sizeof(lcode));
+  memset(c, 0, sizeof(lcode));
+
+  if (unused_count) {
+    c->index = unused[--unused_count];
+  } else {
+    if (codes_count >= codes_cap) {
+      codes_cap = codes_cap ? codes_cap * 2 : 64;
+      codes = lmem_realloc(codes, sizeof(lcode*) * codes_cap);
+    }
+    c->index = codes_count++;
+  }
+
+  codes[c->index] = c;
+  return c->index;
+}
+
+static void lcode_free(lcode* c) {
+  int code = c->index;
+
+  for (int i = 0; i < c->owned_count; i++) {
+    lval_del(c->owned[i]);
+  }
+  lmem_free(c->owned);
+  lmem_free(c->folded);
+  lmem_free(c->ops);
+  lmem_free(c->consts);
+  lmem_free(c->caches);
+  if (c->jit) { ljit_free(c->jit); }
+  lmem_free(c);
+  codes[code] = NULL;
+
+  if (unused_count == unused_cap) {
+    unused_cap = unused_cap ? unused_cap * 2 : 64;
+    unused = lmem_realloc(unused, sizeof(int) * unused_cap);
+  }
+  unused[unused_count++] = code;
+}
+
+void lvm_release(int code) {
+  lcode* c = codes[code];
+  if (c->running) {
+    c->released = 1;
+    return;
+  }
+  lcode_free(c);
+}
+
+//
+// compiling
+//
+
+static int lcode_emit(lcode* c, int op) {
+  if (c->count == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->ops = lmem_realloc(c->ops, sizeof(int) * c->cap);
+  }
+  c->ops[c->count] = op;
+  return c->count++;
+}
+
+static int lcode_push(lval*** vals, int* count, int* cap, lval* v) {
+  if (*count == *cap) {
+    *cap = *cap ? *cap * 2 : 8;
+    *vals = lmem_realloc(*vals, sizeof(lval*) * *cap);
+  }
+  (*vals)[*count] = v;
+  return (*count)++;
+}
+
+static int lcode_const(lcode* c, lval* v) {
+  return lcode_push(&c->consts, &c->consts_count, &c->consts_cap, v);
+}
+
+static int lcode_cache(lcode* c) {
+  if (c->caches_count == c->caches_cap) {
+    c->caches_cap = c->caches_cap ? c->caches_cap * 2 : 8;
+    c->caches = lmem_realloc(c->caches, sizeof(lcache) * c->caches_cap);
+  }
+  c->caches[c->caches_count].version = 0;
+  c->caches[c->caches_count].value = NULL;
+  return c->caches_count++;
+}
+
+//
+// folding, a function body is compiled as the function is created, when
+// its symbols have just been resolved for it, and anything which can be
+// worked out then is, see lvm_fold
+//
+
+// a global is taken to be a constant as long as it has only ever been
+// defined the once, and not bound anywhere else, the first time that
+// changes any code counting on it is thrown away, see lsym_varies, and
+// recompiled without folding anything
+
+// the global environment while folding, otherwise NULL
+static lenv* fold_env = NULL;
+
+// bumped whenever a global something was folded with varies
+static int epoch = 0;
+
+void lvm_deopt(void) {
+  epoch++;
+}
+
+// compiling recurses for every list inside another, past this many levels
+// the rest is left to be compiled separately when it's run
+#define LCODE_MAX_NESTING 64
+
+// whether an 'if' has both branches as they were written, quoted, so they
+// can be compiled in place
+static int lcode_if_inline(lval* list) {
+  return (list->count == 3 || list->count == 4) &&
+    list->cell[2]->type == LVAL_QEXPR &&
+    list->cell[list->count - 1]->type == LVAL_QEXPR;
+}
+
+// values which can be built into code, anything else could refer back
+// to the code itself and never be collected
+static int lcode_foldable(lval* v) {
+  switch (v->type) {
+    case LVAL_NUM:
+    case LVAL_BIG:
+    case LVAL_DBL:
+    case LVAL_VEC:
+    case LVAL_BOOL:
+    case LVAL_STR:
+      return 1;
+    case LVAL_FUN:
+      return v->builtin != NULL;
+  }
+  return 0;
+}
+
+// the const holding v, which the code takes over
+static int lcode_fold_const(lcode* c, lval* v) {
+  lcode_push(&c->owned, &c->owned_count, &c->owned_cap, v);
+  return lcode_const(c, v);
+}
+
+// the value of the global sym, or NULL if it can't be counted on to stay
+// the same, taking note that the code counts on it
+static lval* lcode_fold_sym(lcode* c, lval* sym) {
+  if (sym->depth != LSYM_GLOBAL) { return NULL; }
+
+  int* flags = lsym_flags(sym->sym);
+  if (*flags & LSYM_VARIES) { return NULL; }
+
+  int i = lenv_find(fold_env, sym->sym);
+  if (i == -1 || !lcode_foldable(fold_env->vals[i])) { return NULL; }
+
+  *flags |= LSYM_FOLDED;
+  lcode_push(&c->folded, &c->folded_count, &c->folded_cap, sym);
+  return lval_copy(fold_env->vals[i]);
+}
+
+static lval* lcode_constant_list(lcode* c, lval* list, int depth);
+
+// the value of v, when it can be worked out now, otherwise NULL, giving up
+// on anything nested too deeply to look into
+static lval* lcode_constant(lcode* c, lval* v, int depth) {
+  switch (v->type) {
+    case LVAL_SYM: return lcode_fold_sym(c, v);
+    case LVAL_SEXPR: return lcode_constant_list(c, v, depth + 1);
+    case LVAL_ERR: return NULL;
+  }
+  // everything else evaluates to itself
+  return lval_copy(v);
+}
+
+// the value of list evaluated as a s-expression, the same way
+static lval* lcode_constant_list(lcode* c, lval* list, int depth) {
+  if (depth > LCODE_MAX_NESTING) { return NULL; }
+  if (list->count == 0) { return lval_nil(); }
+  if (list->count == 1) { return lcode_constant(c, list->cell[0], depth); }
+
+  lval* fn = lcode_constant(c, list->cell[0], depth);
+  if (!fn) { return NULL; }
+  if (fn->type != LVAL_FUN || !fn->builtin) {
+    lval_del(fn);
+    return NULL;
+  }
+
+  // only the branch taken matters
+  if (fn->info->op == LB_IF) {
+    lval_del(fn);
+    if (!lcode_if_inline(list)) { return NULL; }
+
+    lval* cond = lcode_constant(c, list->cell[1], depth);
+    if (!cond) { return NULL; }
+    int truthy = lval_true(cond);
+    lval_del(cond);
+
+    if (truthy) { return lcode_constant_list(c, list->cell[2], depth + 1); }
+    if (list->count == 4) { return lcode_constant_list(c, list->cell[3], depth + 1); }
+    return lval_bool(0);
+  }
+
+  // the other special forms are left to be worked out when they're run
+  if (fn->info->flags & LB_SPECIAL) {
+    lval_del(fn);
+    return NULL;
+  }
+
+  if (!(fn->info->flags & LB_PURE)) {
+    lval_del(fn);
+    return NULL;
+  }
+
+  lval* args = lval_sexpr();
+  lval_reserve(args, list->count - 1);
+  for (int i = 1; i < list->count; i++) {
+    lval* arg = lcode_constant(c, list->cell[i], depth);
+    if (!arg) {
+      lval_del(fn);
+      lval_del(args);
+      return NULL;
+    }
+    args = lval_add(args, arg);
+  }
+
+  // errors are left to happen when it's run
+  lval* result = lbuiltin_call(fold_env, fn, args);
+  lval_del(fn);
+  if (result->type == LVAL_ERR) {
+    lval_del(result);
+    return NULL;
+  }
+  return result;
+}
+
+static void lcode_compile_list(lcode* c, lval* list, int tail);
+static void lcode_compile_nested(lcode* c, lval* list, int tail);
+static void lcode_compile(lcode* c, lval* v);
+
+// when v can be worked out now, code pushing its value for as long as
+// what it was worked out from stays the same, and otherwise evaluating v
+// as usual, v is a list when list is set
+static int lcode_fold_value(lcode* c, lval* v, int list, int tail) {
+  if (!fold_env) { return 0; }
+
+  lval* k = list ? lcode_constant_list(c, v, 0) : lcode_constant(c, v, 0);
+  if (!k) { return 0; }
+  if (!lcode_foldable(k)) {
+    lval_del(k);
+    return 0;
+  }
+
+  lcode_emit(c, LOP_FOLDED);
+  lcode_emit(c, lcode_fold_const(c, k));
+  int end = lcode_emit(c, 0);
+
+  lenv* env = fold_env;
+  fold_env = NULL;
+  if (list) {
+    lcode_compile_nested(c, v, tail);
+  } else {
+    lcode_compile(c, v);
+  }
+  fold_env = env;
+
+  c->ops[end] = c->count;
+  return 1;
+}
+
+// code leaving the value of v on the stack
+static void lcode_compile(lcode* c, lval* v) {
+  switch (v->type) {
+    case LVAL_SYM: {
+      if (lcode_fold_value(c, v, 0, 0)) { break; }
+      // arguments and what's closed over already go straight to their slot
+      if (v->depth >= 0) {
+        lcode_emit(c, LOP_LOOKUP);
+        lcode_emit(c, lcode_const(c, v));
+        break;
+      }
+      lcode_emit(c, LOP_GLOBAL);
+      lcode_emit(c, lcode_const(c, v));
+      lcode_emit(c, lcode_cache(c));
+      break;
+    }
+    case LVAL_SEXPR:
+      lcode_compile_list(c, v, 0);
+      break;
+    // everything else evaluates to itself
+    default:
+      lcode_emit(c, LOP_CONST);
+      lcode_emit(c, lcode_const(c, v));
+      break;
+  }
+}
+
+// finishes off a branch, in tail position there's nothing left to do
+// after it so it returns straight away, which also lets a call at the
+// end of it see it's a tail call
+static int lcode_branch_end(lcode* c, int tail) {
+  if (tail) {
+    lcode_emit(c, LOP_RETURN);
+    return -1;
+  }
+  lcode_emit(c, LOP_JUMP);
+  return lcode_emit(c, 0);
+}
+
+// code calling the function on the stack with the rest of list, or when
+// it turns out to be a special form, handing the rest to it as it is, op
+// is LOP_CALL or the instruction standing in for the builtin, which may
+// have been redefined as anything, special forms included
+static void lcode_compile_call(lcode* c, lval* list, int op) {
+  lcode_emit(c, LOP_SPECIAL);
+  lcode_emit(c, lcode_const(c, list));
+  int end = lcode_emit(c, 0);
+
+  for (int i = 1; i < list->count; i++) {
+    lcode_compile(c, list->cell[i]);
+  }
+  lcode_emit(c, op);
+  lcode_emit(c, list->count - 1);
+
+  c->ops[end] = c->count;
+}
+
+// 'if' with the branches written out in place, which are compiled in
+// place too, the function has just been pushed
+static void lcode_compile_if(lcode* c, lval* list, int tail) {
+  lcode_emit(c, LOP_IF);
+  int on_call = lcode_emit(c, 0);
+
+  // the condition
+  lcode_compile(c, list->cell[1]);
+  lcode_emit(c, LOP_JUMP_FALSE);
+  int on_false = lcode_emit(c, 0);
+
+  lcode_compile_list(c, list->cell[2], tail);
+  int end_true = lcode_branch_end(c, tail);
+
+  c->ops[on_false] = c->count;
+  if (list->count == 4) {
+    lcode_compile_list(c, list->cell[3], tail);
+  } else {
+    lcode_emit(c, LOP_CONST);
+    lcode_emit(c, lcode_const(c, lval_bool(0)));
+  }
+  int end_false = lcode_branch_end(c, tail);
+
+  // it isn't 'if', so call whatever it is
+  c->ops[on_call] = c->count;
+  lcode_compile_call(c, list, LOP_CALL);
+
+  if (!tail) {
+    c->ops[end_true] = c->count;
+    c->ops[end_false] = c->count;
+  }
+}
+
+// '&&' or '||' of two operands, only evaluating the second when the
+// first doesn't settle it
+static void lcode_compile_logic(lcode* c, lval* list, int op, int tail) {
+  lcode_emit(c, op);
+  int on_call = lcode_emit(c, 0);
+
+  // '&&' is settled by anything false, '||' by anything true
+  int settle = (op == LOP_AND) ? LOP_JUMP_FALSE : LOP_JUMP_TRUE;
+  int settled[2];
+  for (int i = 0; i < 2; i++) {
+    lcode_compile(c, list->cell[i + 1]);
+    lcode_emit(c, settle);
+    settled[i] = lcode_emit(c, 0);
+  }
+
+  lcode_emit(c, LOP_CONST);
+  lcode_emit(c, lcode_const(c, lval_bool(op == LOP_AND)));
+  int end_unsettled = lcode_branch_end(c, tail);
+
+  c->ops[settled[0]] = c->count;
+  c->ops[settled[1]] = c->count;
+  lcode_emit(c, LOP_CONST);
+  lcode_emit(c, lcode_const(c, lval_bool(op == LOP_OR)));
+  int end_settled = lcode_branch_end(c, tail);
+
+  c->ops[on_call] = c->count;
+  lcode_compile_call(c, list, LOP_CALL);
+
+  if (!tail) {
+    c->ops[end_unsettled] = c->count;
+    c->ops[end_settled] = c->count;
+  }
+}
+
+// 'do', each operand in turn, keeping only the last
+static void lcode_compile_do(lcode* c, lval* list, int tail) {
+  lcode_emit(c, LOP_DO);
+  int on_call = lcode_emit(c, 0);
+
+  for (int i = 1; i < list->count - 1; i++) {
+    lcode_compile(c, list->cell[i]);
+    lcode_emit(c, LOP_DROP);
+  }
+
+  // the last is the value, a call there is in tail position when the
+  // 'do' is
+  lval* last = list->cell[list->count - 1];
+  if (last->type == LVAL_SEXPR) {
+    lcode_compile_list(c, last, tail);
+  } else {
+    lcode_compile(c, last);
+  }
+  int end = lcode_branch_end(c, tail);
+
+  c->ops[on_call] = c->count;
+  lcode_compile_call(c, list, LOP_CALL);
+
+  if (!tail) { c->ops[end] = c->count; }
+}
+
+// 'if' which is the builtin, with a condition known already, so only the
+// branch taken is compiled, for as long as that stays the same, with the
+// whole 'if' to fall back on
+static int lcode_fold_if(lcode* c, lval* list, int tail) {
+  if (!fold_env) { return 0; }
+
+  lval* fn = lcode_constant(c, list->cell[0], 0);
+  if (!fn) { return 0; }
+  int is_if = fn->type == LVAL_FUN && fn->builtin && fn->info->op == LB_IF;
+  lval_del(fn);
+  if (!is_if) { return 0; }
+
+  lval* cond = lcode_constant(c, list->cell[1], 0);
+  if (!cond) { return 0; }
+  int truthy = lval_true(cond);
+  lval_del(cond);
+
+  lcode_emit(c, LOP_STALE);
+  int stale = lcode_emit(c, 0);
+
+  if (truthy) {
+    lcode_compile_list(c, list->cell[2], tail);
+  } else if (list->count == 4) {
+    lcode_compile_list(c, list->cell[3], tail);
+  } else {
+    lcode_emit(c, LOP_CONST);
+    lcode_emit(c, lcode_const(c, lval_bool(0)));
+  }
+  int end = lcode_branch_end(c, tail);
+
+  c->ops[stale] = c->count;
+  lenv* env = fold_env;
+  fold_env = NULL;
+  lcode_compile(c, list->cell[0]);
+  lcode_compile_if(c, list, tail);
+  fold_env = env;
+
+  if (!tail) { c->ops[end] = c->count; }
+  return 1;
+}
+
+static void lcode_compile_nested(lcode* c, lval* list, int tail) {
+  // evaluates to an empty s-expression
+  if (list->count == 0) {
+    lcode_emit(c, LOP_CONST);
+    lcode_emit(c, lcode_const(c, lval_nil()));
+    return;
+  }
+
+  // and a single one to its only value
+  if (list->count == 1) {
+    if (list->cell[0]->type == LVAL_SEXPR) {
+      lcode_compile_list(c, list->cell[0], tail);
+    } else {
+      lcode_compile(c, list->cell[0]);
+    }
+    return;
+  }
+
+  // or something which can be worked out already
+  if (lcode_fold_value(c, list, 1, tail)) { return; }
+
+  // otherwise it's a call, the function is evaluated first
+  lval* fn = list->cell[0];
+
+  int op = LOP_CALL;
+  if (fn->type == LVAL_SYM) {
+    for (int i = 0; i < LOP_INLINED; i++) {
+      if (fn->sym == *inlined[i].sym) { op = inlined[i].op; }
+    }
+  }
+
+  // only with both branches as they were written
+  if (op == LOP_IF) {
+    if (lcode_if_inline(list)) {
+      if (lcode_fold_if(c, list, tail)) { return; }
+      lcode_compile(c, fn);
+      lcode_compile_if(c, list, tail);
+      return;
+    }
+    op = LOP_CALL;
+  }
+
+  // the rest of the special forms, given what they take
+  if ((op == LOP_AND || op == LOP_OR) && list->count == 3) {
+    lcode_compile(c, fn);
+    lcode_compile_logic(c, list, op, tail);
+    return;
+  }
+  if (op == LOP_DO) {
+    lcode_compile(c, fn);
+    lcode_compile_do(c, list, tail);
+    return;
+  }
+  if (op == LOP_AND || op == LOP_OR) { op = LOP_CALL; }
+
+  lcode_compile(c, fn);
+  lcode_compile_call(c, list, op);
+}
+
+static int nesting = 0;
+
+// code leaving the value of list, evaluated as a s-expression, on the
+// stack, whatever type it is, so the branches of an 'if' or a function
+// body can be compiled just the same, tail is set when nothing else will
+// be done before returning that value
+static void lcode_compile_list(lcode* c, lval* list, int tail) {
+  if (nesting == LCODE_MAX_NESTING) {
+    lcode_emit(c, LOP_EVAL);
+    lcode_emit(c, lcode_const(c, list));
+    return;
+  }
+
+  nesting++;
+  lcode_compile_nested(c, list, tail);
+  nesting--;
+}
+
+// the compiled form of a list, compiling it the first time
+static lcode* lcode_of(lval* list) {
+  // folded code goes stale once something it folded varies, and is
+  // compiled again as it is
+  if (list->code) {
+    lcode* c = codes[list->code];
+    if (c->folded_count && c->epoch != epoch) {
+      lvm_release(list->code);
+      list->code = 0;
+    }
+  }
+
+  if (!list->code) {
+    int code = lcode_new();
+    lcode_compile_list(codes[code], list, 1);
+    lcode_emit(codes[code], LOP_RETURN);
+    list->code = code;
+  }
+  return codes[list->code];
+}
+
+// compiles the body of the user function fn, working out what it can
+static void lcode_fold(lval* fn) {
+  lenv* env = fn->env;
+  while (env->parent) { env = env->parent; }
+
+  int code = lcode_new();
+  codes[code]->epoch = epoch;
+  fold_env = env;
+  lcode_compile_list(codes[code], fn->body, 1);
+  lcode_emit(codes[code], LOP_RETURN);
+  fold_env = NULL;
+
+  fn->body->code = code;
+}
+
+// called as fn is created, just after its symbols have been resolved
+void lvm_fold(lval* fn) {
+  lval* body = fn->body;
+
+  // the body is shared with another function, made from the same list,
+  // its code can only stay folded if what was folded is global here too
+  if (body->code) {
+    lcode* c = codes[body->code];
+    for (int i = 0; i < c->folded_count; i++) {
+      if (c->folded[i]->depth != LSYM_GLOBAL) {
+        lvm_release(body->code);
+        body->code = 0;
+        break;
+      }
+    }
+    return;
+  }
+
+  lcode_fold(fn);
+}
+
+// folds the global functions in env's global environment all over
+// again, once everything they might count on has been defined
+void lvm_refold(lenv* env) {
+  while (env->parent) { env = env->parent; }
+
+  for (int i = 0; i < env->count; i++) {
+    lval* fn = env->vals[i];
+
+    // only bodies no other function shares, their symbols are resolved
+    // for this one and this one alone
+    if (fn->type != LVAL_FUN || fn->builtin || fn->body->refs != 1) { continue; }
+
+    lval_resolve(fn->body, fn->formals, fn->env);
+    if (fn->body->code) {
+      lvm_release(fn->body->code);
+      fn->body->code = 0;
+    }
+    lcode_fold(fn);
+  }
+}
+
+//
+//
+// THE MACHINE
+//
+//
+
+typedef struct lvm_frame {
+  // the list being run, which holds on to its code, holds a reference
+  lval* body;
+  lcode* code;
+  int pc;
+  // what it's evaluated in, holds a reference
+  lenv* env;
+  // the body of a memoised function, and the arguments to keep its
+  // result for once it returns, both hold a reference, otherwise NULL
+  lval* memo;
+  lval* key;
+} lvm_frame;
+
+// shared by every run, a run started by a builtin the vm called goes on
+// above the one which called it
+static lval** stack = NULL;
+static int stack_count = 0;
+static int stack_cap = 0;
+
+static lvm_frame* frames = NULL;
+static int frames_count = 0;
+static int frames_cap = 0;
+
+static void lvm_push(lval* v) {
+  if (stack_count == stack_cap) {
+    stack_cap = stack_cap ? stack_cap * 2 : 256;
+    stack = lmem_realloc(stack, sizeof(lval*) * stack_cap);
+  }
+  stack[stack_count++] = v;
+}
+
+// takes over both references
+static void lvm_enter(lenv* env, lval* body) {
+  if (frames_count == frames_cap) {
+    frames_cap = frames_cap ? frames_cap * 2 : 64;
+    frames = lmem_realloc(frames, sizeof(lvm_frame) * frames_cap);
+  }
+
+  lvm_frame* f = &frames[frames_count++];
+  f->body = body;
+  f->code = lcode_of(body);
+  f->code->running++;
+  f->pc = 0;
+  f->env = env;
+  f->memo = NULL;
+  f->key = NULL;
+}
+
+static void lvm_leave(void) {
+  lvm_frame* f = &frames[--frames_count];
+
+  // its code went stale while it ran
+  if (--f->code->running == 0 && f->code->released) { lcode_free(f->code); }
+
+  lenv_del(f->env);
+  lval_del(f->body);
+  if (f->memo) {
+    lval_del(f->memo);
+    lval_del(f->key);
+  }
+}
+
+// whether f has nothing left to do but return, so whatever it calls can
+// take its place, unless it has a result to keep
+static int lvm_tail(lvm_frame* f) {
+  return f->code->ops[f->pc] == LOP_RETURN && !f->memo;
+}
+
+// enters a frame, unless that goes deeper than leval_max_depth allows,
+// when both are dropped and the error handed back
+static lval* lvm_descend(lenv* env, lval* body) {
+  if (leval_max_depth > 0 && frames_count >= leval_max_depth) {
+    lenv_del(env);
+    lval_del(body);
+    return lval_too_deep();
+  }
+  lvm_enter(env, body);
+  return NULL;
+}
+
+// the result of calling the user function fn natively, or NULL when it
+// has to be evaluated here, in frame 'at', its body is compiled the first
+// time it has been called LJIT_THRESHOLD times, and again once what that
+// counted on changes, args are left alone
+static lval* lvm_jit(lval* fn, lval* args, int at) {
+  if (!ljit_enabled || !fn->body->code) { return NULL; }
+
+  lcode* c = codes[fn->body->code];
+
+  // a call which went too deep natively is run here, and so is every call
+  // to the same function nested under it, otherwise each of those would
+  // go LJIT_MAX_DEPTH deep natively only to bail again, once it's done
+  // native code is fine again
+  if (c->too_deep) {
+    if (frames_count >= c->too_deep) { return NULL; }
+    c->too_deep = 0;
+  }
+
+  if (c->jit && !ljit_valid(c->jit)) {
+    ljit_free(c->jit);
+    c->jit = NULL;
+    c->calls = 0;
+  }
+  if (!c->jit) {
+    if (++c->calls != LJIT_THRESHOLD) { return NULL; }
+    c->jit = ljit_compile(fn);
+    if (!c->jit) { return NULL; }
+  }
+  // compiled for another function with the same body
+  if (!ljit_fits(c->jit, fn)) { return NULL; }
+
+  // native calls count towards leval_max_depth the same as frames
+  int depth = LJIT_MAX_DEPTH;
+  if (leval_max_depth > 0 && leval_max_depth - frames_count < depth) {
+    depth = leval_max_depth - frames_count;
+  }
+  int too_deep;
+  lval* result = ljit_call(c->jit, args, depth, &too_deep);
+  if (too_deep) { c->too_deep = at + 1; }
+  return result;
+}
+
+// builtin_op's floats, written over an operand nobody else holds where
+// there is one, or NULL when it would divide by zero
+static lval* lvm_arith_dbl(int op, lval** args, int n) {
+  double x = lnum_dbl(args[0]);
+  if (op == LB_SUB && n == 1) { x = -x; }
+
+  for (int i = 1; i < n; i++) {
+    if (!lnum_arith_dbl(op, x, lnum_dbl(args[i]), &x)) { return NULL; }
+  }
+  return lnum_dbl_into(args, n, x);
+}
+
+// reduces the numbers as builtin_op would, returns NULL when it isn't
+// given numbers, or would divide by zero, which builtin_op should see to
+static lval* lvm_arith(int op, lval** args, int n) {
+  if (n == 0) { return NULL; }
+
+  int dbl = 0;
+  for (int i = 0; i < n; i++) {
+    if (args[i]->type == LVAL_DBL) { dbl = 1; continue; }
+    if (args[i]->type != LVAL_NUM) { return NULL; }
+  }
+  if (dbl) { return lvm_arith_dbl(op, args, n); }
+
+  long x = args[0]->num;
+  if (op == LB_SUB && n == 1 && !lnum_arith(LB_SUB, 0, x, &x)) { return NULL; }
+
+  for (int i = 1; i < n; i++) {
+    if (!lnum_arith(op, x, args[i]->num, &x)) { return NULL; }
+  }
+
+  return lval_num(x);
+}
+
+// compares two numbers as builtin_compare would, returns 0 when it
+// isn't given two numbers
+static int lvm_compare(int op, lval** args, int n, int* out) {
+  if (n != 2) { return 0; }
+  if (args[0]->type == LVAL_NUM && args[1]->type == LVAL_NUM) {
+    *out = lnum_compare(op, args[0]->num, args[1]->num);
+    return 1;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (args[i]->type != LVAL_NUM && args[i]->type != LVAL_DBL) { return 0; }
+  }
+  *out = lnum_compare_dbl(op, lnum_dbl(args[0]), lnum_dbl(args[1]));
+  return 1;
+}
+
+// drops everything the run which started with base frames and values
+// left behind, and hands back the error which stopped it
+static lval* lvm_unwind(int base_frames, int base_stack, lval* err) {
+  while (stack_count > base_stack) { lval_del(stack[--stack_count]); }
+  while (frames_count > base_frames) { lvm_leave(); }
+  return err;
+}
+
+// evaluates expr as the tree walker's lval_eval_sexpr would, takes it over
+lval* lvm_eval(lenv* env, lval* expr) {
+  int base_frames = frames_count;
+  int base_stack = stack_count;
+
+  lvm_enter(lenv_copy(env), expr);
+
+  for (;;) {
+    lvm_frame* f = &frames[frames_count - 1];
+    int* ops = f->code->ops;
+    int op = ops[f->pc++];
+    int n = 0;
+
+    switch (op) {
+      case LOP_CONST: {
+        // the reader leaves errors in place of numbers it can't read
+        lval* v = lval_copy(f->code->consts[ops[f->pc++]]);
+        if (v->type == LVAL_ERR) { return lvm_unwind(base_frames, base_stack, v); }
+        lvm_push(v);
+        break;
+      }
+
+      case LOP_LOOKUP: {
+        lval* v = lenv_get(f->env, f->code->consts[ops[f->pc++]]);
+        if (v->type == LVAL_ERR) { return lvm_unwind(base_frames, base_stack, v); }
+        lvm_push(v);
+        break;
+      }
+
+      case LOP_GLOBAL: {
+        lcache* cache = &f->code->caches[ops[f->pc + 1]];
+        if (cache->version == lenv_version) {
+          lvm_push(lval_copy(cache->value));
+          f->pc += 2;
+          break;
+        }
+
+        lval* sym = f->code->consts[ops[f->pc]];
+        f->pc += 2;
+        lval* v = lenv_get(f->env, sym);
+        if (v->type == LVAL_ERR) { return lvm_unwind(base_frames, base_stack, v); }
+
+        if (!(*lsym_flags(sym->sym) & LSYM_LOCAL)) {
+          cache->version = lenv_version;
+          cache->value = v;
+        }
+        lvm_push(v);
+        break;
+      }
+
+      case LOP_ADD: case LOP_SUB: case LOP_MUL:
+      case LOP_DIV: case LOP_MOD: case LOP_POW: {
+        n = ops[f->pc++];
+        lval* fn = stack[stack_count - n - 1];
+        lval* x;
+        if (!lop_is(op, fn) ||
+            !(x = lvm_arith(lop_builtin(op), &stack[stack_count - n], n))) {
+          goto call;
+        }
+
+        while (n--) { lval_del(stack[--stack_count]); }
+        lval_del(fn);
+        stack[stack_count - 1] = x;
+        break;
+      }
+
+      case LOP_GT: case LOP_LT: case LOP_GTE:
+      case LOP_LTE: case LOP_EQ: case LOP_NEQ: {
+        n = ops[f->pc++];
+        lval* fn = stack[stack_count - n - 1];
+        int b;
+        if (!lop_is(op, fn) ||
+            !lvm_compare(lop_builtin(op), &stack[stack_count - n], n, &b)) {
+          goto call;
+        }
+
+        while (n--) { lval_del(stack[--stack_count]); }
+        lval_del(fn);
+        stack[stack_count - 1] = lval_bool(b);
+        break;
+      }
+
+      case LOP_HEAD: case LOP_TAIL: {
+        n = ops[f->pc++];
+        lval* fn = stack[stack_count - n - 1];
+        lval* list = stack[stack_count - 1];
+        if (!lop_is(op, fn) || n != 1 || list->type != LVAL_QEXPR || list->count == 0) {
+          goto call;
+        }
+
+        stack_count--;
+        lval_del(fn);
+        stack[stack_count - 1] = (op == LOP_HEAD) ? lval_head(list) : lval_tail(list);
+        break;
+      }
+
+      case LOP_IF: case LOP_AND: case LOP_OR: case LOP_DO:
+        if (!lop_is(op, stack[stack_count - 1])) {
+          f->pc = ops[f->pc];
+          break;
+        }
+        lval_del(stack[--stack_count]);
+        f->pc++;
+        break;
+
+      case LOP_JUMP:
+        f->pc = ops[f->pc];
+        break;
+
+      case LOP_JUMP_FALSE: case LOP_JUMP_TRUE: {
+        lval* cond = stack[--stack_count];
+        int truthy = lval_true(cond);
+        lval_del(cond);
+
+        f->pc = (truthy == (op == LOP_JUMP_TRUE)) ? ops[f->pc] : f->pc + 1;
+        break;
+      }
+
+      case LOP_DROP:
+        lval_del(stack[--stack_count]);
+        break;
+
+      case LOP_SPECIAL: {
+        lval* fn = stack[stack_count - 1];
+        if (!lval_special(fn)) {
+          f->pc += 2;
+          break;
+        }
+
+        lval* list = f->code->consts[ops[f->pc]];
+        f->pc = ops[f->pc + 1];
+        stack_count--;
+        int tail = lvm_tail(f);
+
+        // a window onto the operands, which it only reads
+        lval* args = lval_slice(lval_copy(list), 1, list->count - 1);
+        args->type = LVAL_SEXPR;
+
+        lval* result = lbuiltin_call(f->env, fn, args);
+        lval_del(fn);
+        f = &frames[frames_count - 1];
+
+        // what's left to evaluate, such as the branch 'if' took
+        lenv* env;
+        lval* later = lval_deferred(result, &env);
+        if (later) {
+          if (!env) { env = lenv_copy(f->env); }
+          if (tail) { lvm_leave(); }
+
+          lval* err = lvm_descend(env, later);
+          if (err) { return lvm_unwind(base_frames, base_stack, err); }
+          break;
+        }
+
+        if (result->type == LVAL_ERR) { return lvm_unwind(base_frames, base_stack, result); }
+        lvm_push(result);
+        break;
+      }
+
+      case LOP_FOLDED:
+        if (f->code->epoch != epoch) {
+          f->pc += 2;
+          break;
+        }
+        lvm_push(lval_copy(f->code->consts[ops[f->pc]]));
+        f->pc = ops[f->pc + 1];
+        break;
+
+      case LOP_STALE:
+        f->pc = (f->code->epoch != epoch) ? ops[f->pc] : f->pc + 1;
+        break;
+
+      case LOP_EVAL: {
+        lval* list = lval_copy(f->code->consts[ops[f->pc++]]);
+        lenv* env = lenv_copy(f->env);
+        if (lvm_tail(f)) { lvm_leave(); }
+
+        lval* err = lvm_descend(env, list);
+        if (err) { return lvm_unwind(base_frames, base_stack, err); }
+        break;
+      }
+
+      case LOP_CALL:
+        n = ops[f->pc++];
+      call: {
+        // a safe point, everything is on the stack or in a frame
+        lgc_maybe_collect();
+
+        // nothing left to do in this frame but return what the call
+        // gives, so whatever the call goes on to evaluate can take its
+        // place, rather than the frames piling up
+        int tail = lvm_tail(f);
+
+        lval* args = lval_sexpr();
+        lval_reserve(args, n);
+        stack_count -= n;
+        memcpy(args->cell, &stack[stack_count], sizeof(lval*) * n);
+        args->count = n;
+
+        lval* fn = stack[--stack_count];
+
+        if (!lval_callable(fn)) {
+          lval* err = lval_err("incorrect type found when evaluating a symbolic expression, '%s' is not a function", lval_human_name(fn->type));
+          lval_del(fn);
+          lval_del(args);
+          return lvm_unwind(base_frames, base_stack, err);
+        }
+
+        // memoised, either it's been seen before, or the call goes ahead
+        // and the frame it goes on in keeps the result as it returns
+        lval* memo = NULL;
+        if (fn->type == LVAL_MEMO) {
+          lval* seen = lmemo_get(fn->memo, args);
+          if (seen) {
+            lval_del(fn);
+            lval_del(args);
+            lvm_push(seen);
+            break;
+          }
+          memo = fn;
+          fn = lval_copy(lmemo_fn(memo->memo));
+        }
+        lval* key = memo ? lval_copy(args) : NULL;
+
+        // called with everything it's been given so far
+        if (fn->type == LVAL_PARTIAL) { args = lval_applied(&fn, args); }
+
+        lval* result;
+        if (fn->builtin) {
+          result = lbuiltin_call(f->env, fn, args);
+          lval_del(fn);
+
+          // running the builtin may have moved the frames
+          f = &frames[frames_count - 1];
+
+          // 'eval' leaving us something to evaluate where we are
+          lenv* env;
+          lval* later = lval_deferred(result, &env);
+          if (later) {
+            if (!env) { env = lenv_copy(f->env); }
+            if (tail) { lvm_leave(); }
+
+            lval* err = lvm_descend(env, later);
+            if (err) { return lvm_unwind(base_frames, base_stack, err); }
+            break;
+          }
+        } else if ((result = lvm_jit(fn, args, tail ? frames_count - 1 : frames_count))) {
+          lval_del(fn);
+          lval_del(args);
+        } else {
+          lenv* frame;
+          result = lval_bind(fn, args, &frame);
+
+          // the body goes on in a frame of its own, rather than
+          // recursing here
+          if (!result) {
+            lval* body = lval_copy(fn->body);
+            lval_del(fn);
+            if (tail) { lvm_leave(); }
+
+            lval* err = lvm_descend(frame, body);
+            if (err) {
+              if (memo) {
+                lval_del(memo);
+                lval_del(key);
+              }
+              return lvm_unwind(base_frames, base_stack, err);
+            }
+            frames[frames_count - 1].memo = memo;
+            frames[frames_count - 1].key = key;
+            break;
+          }
+          lval_del(fn);
+        }
+
+        if (memo) {
+          if (result->type != LVAL_ERR) {
+            lmemo_put(memo->memo, key, result);
+          } else {
+            lval_del(key);
+          }
+          lval_del(memo);
+        }
+
+        if (result->type == LVAL_ERR) { return lvm_unwind(base_frames, base_stack, result); }
+        lvm_push(result);
+        break;
+      }
+
+      case LOP_RETURN:
+        // the value stays where it is, on top of the stack
+        if (f->memo && stack[stack_count - 1]->type != LVAL_ERR) {
+          lmemo_put(f->memo->memo, f->key, stack[stack_count - 1]);
+          f->key = NULL;
+          lval_del(f->memo);
+          f->memo = NULL;
+        }
+        lvm_leave();
+        if (frames_count == base_frames) {
+          lval* result = stack[--stack_count];
+          if (result->type == LVAL_ERR) { return lvm_unwind(base_frames, base_stack, result); }
+          return result;
+        }
+        break;
+    }
+  }
+}